@@ -0,0 +1,207 @@
+#include "archive.h"
+#include <stdlib.h>
+#include <string.h>
+#include "array.h"
+#include "replay.h"
+
+bool archive_detect(const struct input *input)
+{
+    return input->length >= sizeof(struct archive_header) &&
+           memcmp(input->data, ARCHIVE_MAGIC, sizeof(((struct archive_header *) 0)->magic)) == 0;
+}
+
+bool archive_open(const struct input *input, struct archive *archive)
+{
+    if (!archive_detect(input)) {
+        return false;
+    }
+    const struct archive_header *header = (const struct archive_header *) input->data;
+    if (header->version != ARCHIVE_VERSION || header->start_count == 0) {
+        return false;
+    }
+
+    // the sizes are checked by division so that a damaged count cannot overflow them
+    size_t available = input->length - sizeof(struct archive_header);
+    if (header->game_count > available / sizeof(struct archive_game)) {
+        return false;
+    }
+    available -= header->game_count * sizeof(struct archive_game);
+    if (header->start_count > available / sizeof(struct archive_start)) {
+        return false;
+    }
+    available -= header->start_count * sizeof(struct archive_start);
+    if (header->move_count > available / sizeof(packed_move)) {
+        return false;
+    }
+
+    archive->games = (const struct archive_game *) (header + 1);
+    archive->starts = (const struct archive_start *) (archive->games + header->game_count);
+    archive->moves = (const packed_move *) (archive->starts + header->start_count);
+    archive->game_count = header->game_count;
+    archive->start_count = header->start_count;
+
+    // every start is checked here so that replaying a game cannot fail to set one up; the last one checked is
+    // the default
+    for (size_t i = archive->start_count; i-- > 0;) {
+        const char *fen = archive->starts[i].fen;
+        if (memchr(fen, '\0', BOARD_FEN_MAX) == NULL || !board_from_fen(&archive->start, fen)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < archive->game_count; i++) {
+        const struct archive_game *game = &archive->games[i];
+        if (game->first_move > header->move_count || game->move_count > header->move_count - game->first_move ||
+            game->start >= archive->start_count || game->status >= CHESS_STATUS_COUNT ||
+            game->result > RECORDED_DRAW) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The packed moves of all games so far, grown by doubling.
+struct move_buffer
+{
+    packed_move *moves;
+    size_t count;
+    size_t capacity;
+};
+
+static bool move_buffer_push(struct move_buffer *buffer, packed_move move)
+{
+    packed_move *moves = array_reserve(buffer->moves, &buffer->capacity, buffer->count, sizeof(packed_move));
+    if (moves == NULL) {
+        return false;
+    }
+    buffer->moves = moves;
+    moves[buffer->count++] = move;
+    return true;
+}
+
+// The start positions of the games archived so far, the first being the
+// default one.
+struct start_buffer
+{
+    struct archive_start *starts;
+    size_t count;
+    size_t capacity;
+};
+
+// Finds the start with the given FEN, adding it if there is none. Only the
+// default start and the last one added are compared, which finds the start of
+// every game in a corpus that mostly starts from the same position or where
+// the games from one position come together. Returns the index of the start,
+// or -1 if memory runs out.
+static long start_buffer_find(struct start_buffer *buffer, const char *fen)
+{
+    if (buffer->count > 0 && strcmp(buffer->starts[0].fen, fen) == 0) {
+        return 0;
+    }
+    if (buffer->count > 1 && strcmp(buffer->starts[buffer->count - 1].fen, fen) == 0) {
+        return (long) buffer->count - 1;
+    }
+    struct archive_start *starts = array_reserve(buffer->starts, &buffer->capacity, buffer->count,
+                                                 sizeof(struct archive_start));
+    if (starts == NULL) {
+        return -1;
+    }
+    buffer->starts = starts;
+    memset(&starts[buffer->count], 0, sizeof(struct archive_start));
+    strcpy(starts[buffer->count].fen, fen);
+    return (long) buffer->count++;
+}
+
+// The moves and start positions of the games archived so far, and where the
+// one being replayed starts and what it records as its result.
+struct archive_writer
+{
+    struct move_buffer buffer;
+    struct start_buffer starts;
+    uint32_t start;
+    enum recorded_result result;
+    bool ok;
+};
+
+static void record_move(void *context, const struct replay_step *step)
+{
+    struct archive_writer *writer = context;
+    if (step->ply == 0) {
+        char fen[BOARD_FEN_MAX];
+        board_to_fen(step->board, fen, sizeof(fen));
+        long start = start_buffer_find(&writer->starts, fen);
+        writer->ok = writer->ok && start >= 0;
+        writer->start = start >= 0 ? (uint32_t) start : 0;
+    } else {
+        writer->ok = writer->ok && move_buffer_push(&writer->buffer, step->move);
+    }
+}
+
+static void record_result(void *context, enum recorded_result result)
+{
+    struct archive_writer *writer = context;
+    writer->result = result;
+}
+
+bool archive_write(FILE *stream, const struct input *input, const struct game_index *index,
+                   const struct chess_board *start, long error_counts[CHESS_STATUS_COUNT])
+{
+    struct archive_game *games = calloc(index->count ? index->count : 1, sizeof(struct archive_game));
+    if (games == NULL) {
+        return false;
+    }
+    for (int status = 0; status < CHESS_STATUS_COUNT; status++) {
+        error_counts[status] = 0;
+    }
+
+    // the default start goes first, whether or not any game starts there
+    struct archive_writer writer = {{NULL, 0, 0}, {NULL, 0, 0}, 0, RECORDED_NONE, true};
+    struct chess_board board;
+    char fen[BOARD_FEN_MAX];
+    if (start != NULL) {
+        board_copy(&board, start);
+    } else {
+        board_initialize(&board);
+    }
+    board_to_fen(&board, fen, sizeof(fen));
+    writer.ok = start_buffer_find(&writer.starts, fen) == 0;
+
+    struct replay_visitor visitor = {record_move, record_result, &writer};
+    struct replay_source source = {input, index, start, NULL};
+    struct chess_error error;
+    for (size_t i = 0; i < index->count && writer.ok; i++) {
+        int move_count;
+        games[i].first_move = writer.buffer.count;
+        writer.start = 0;
+        writer.result = RECORDED_NONE;
+        enum chess_status status = replay_source_game(&source, i, &board, OUTPUT_QUIET, NULL, &visitor, &move_count,
+                                                      &error);
+        games[i].move_count = (uint32_t) (writer.buffer.count - games[i].first_move);
+        games[i].start = writer.start;
+        games[i].status = (uint8_t) status;
+        games[i].result = (uint8_t) writer.result;
+        error_counts[status]++;
+    }
+
+    bool ok = writer.ok;
+    if (ok) {
+        struct archive_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+        header.version = ARCHIVE_VERSION;
+        header.game_count = index->count;
+        header.move_count = writer.buffer.count;
+        header.start_count = writer.starts.count;
+
+        ok = fwrite(&header, sizeof(header), 1, stream) == 1 &&
+             fwrite(games, sizeof(struct archive_game), index->count, stream) == index->count &&
+             fwrite(writer.starts.starts, sizeof(struct archive_start), writer.starts.count, stream) ==
+                     writer.starts.count &&
+             fwrite(writer.buffer.moves, sizeof(packed_move), writer.buffer.count, stream) == writer.buffer.count &&
+             fflush(stream) == 0;
+    }
+    free(games);
+    free(writer.starts.starts);
+    free(writer.buffer.moves);
+    return ok;
+}
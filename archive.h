@@ -0,0 +1,83 @@
+#ifndef APSC143__ARCHIVE_H
+#define APSC143__ARCHIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "board.h"
+#include "input.h"
+#include "status.h"
+
+// A binary file of games that have already been replayed once, so that
+// replaying them again needs neither SAN parsing nor working out which piece
+// moves. The layout is:
+//
+//   struct archive_header
+//   struct archive_game    games[game_count]
+//   struct archive_start   starts[start_count]
+//   packed_move            moves[move_count]
+//
+// Numbers are stored in the byte order of the machine that wrote the file;
+// the version check rejects a file written with the other order.
+
+#define ARCHIVE_MAGIC "CHESSARC"
+#define ARCHIVE_VERSION 1
+
+struct archive_header
+{
+    char magic[8]; // ARCHIVE_MAGIC, without a NUL
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t game_count;
+    uint64_t move_count;
+    uint64_t start_count; // at least 1
+};
+
+// A position games start from. The first is where games start unless their
+// FEN tag sets up another.
+struct archive_start
+{
+    char fen[BOARD_FEN_MAX]; // NUL-terminated
+};
+
+// Where a game's moves are. A game that could not be replayed when it was
+// archived keeps the moves before the bad one, and the status says why the
+// next one failed.
+struct archive_game
+{
+    uint64_t first_move; // index into the moves
+    uint32_t move_count;
+    uint32_t start;      // index into the starts
+    uint8_t status;      // a chess_status
+    uint8_t result;      // a recorded_result
+    uint8_t reserved[6];
+};
+
+// An archive read in place from an input, e.g. a mapped file. The pointers
+// point into the input, which must outlive the archive.
+struct archive
+{
+    const struct archive_game *games;
+    const struct archive_start *starts;
+    const packed_move *moves;
+    size_t game_count;
+    size_t start_count;
+    struct chess_board start; // starts[0], set up once since most games begin there
+};
+
+// Checks if the input starts like an archive.
+bool archive_detect(const struct input *input);
+
+// Reads the archive held in the input. Returns false if it is not an archive
+// or is truncated or damaged.
+bool archive_open(const struct input *input, struct archive *archive);
+
+// Replays every indexed game of the input from *start, or from the initial
+// position if start is NULL, or from the position their FEN tag sets up, and
+// writes them to the stream as an archive. error_counts[status] is set to the number of games that ended with each
+// status. Returns false if writing fails or memory runs out.
+bool archive_write(FILE *stream, const struct input *input, const struct game_index *index,
+                   const struct chess_board *start, long error_counts[CHESS_STATUS_COUNT]);
+
+#endif
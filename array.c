@@ -0,0 +1,34 @@
+#include "array.h"
+#include <stdlib.h>
+#include <string.h>
+
+void *array_reserve(void *items, size_t *capacity, size_t count, size_t size)
+{
+    if (count < *capacity) {
+        return items;
+    }
+    size_t grown_capacity = *capacity ? *capacity * 2 : 1 << 16;
+    void *grown = realloc(items, grown_capacity * size);
+    if (grown != NULL) {
+        *capacity = grown_capacity;
+    }
+    return grown;
+}
+
+size_t array_lower_bound(const void *items, size_t count, size_t size, uint64_t key)
+{
+    const char *bytes = items;
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        uint64_t middle_key;
+        memcpy(&middle_key, bytes + middle * size, sizeof(middle_key));
+        if (middle_key < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
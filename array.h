@@ -0,0 +1,17 @@
+#ifndef APSC143__ARRAY_H
+#define APSC143__ARRAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Makes room for one more item in a heap array holding count items of the
+// given size, doubling its capacity when it is full. items may be NULL with a
+// capacity of 0. Returns the array, which may have moved, or NULL if memory
+// runs out, in which case the old array is left as it was.
+void *array_reserve(void *items, size_t *capacity, size_t count, size_t size);
+
+// Finds the first of count items of the given size, sorted by a uint64_t key
+// at the start of each, whose key is not less than the given one.
+size_t array_lower_bound(const void *items, size_t count, size_t size, uint64_t key);
+
+#endif
@@ -0,0 +1,204 @@
+#include "bitboard.h"
+
+bitboard knight_attack_table[64];
+bitboard king_attack_table[64];
+bitboard pawn_attack_table[2][64];
+
+// Shifts that drop bits which would wrap around to the other side of the board.
+static bitboard shift_east(bitboard b) { return (b << 1) & ~FILE_A_MASK; }
+static bitboard shift_west(bitboard b) { return (b >> 1) & ~FILE_H_MASK; }
+
+// walks each direction from the square until it leaves the board or hits a piece
+static bitboard slide(int square, bitboard occupied, const int dirs[4][2]) {
+    bitboard attacks = 0;
+    for (int d = 0; d < 4; d++) {
+        int x = SQUARE_FILE(square) + dirs[d][0];
+        int y = SQUARE_RANK(square) + dirs[d][1];
+        while (x >= 0 && x < 8 && y >= 0 && y < 8) {
+            bitboard bit = SQUARE_BIT(SQUARE(x, y));
+            attacks |= bit;
+            if (occupied & bit) break;
+            x += dirs[d][0];
+            y += dirs[d][1];
+        }
+    }
+    return attacks;
+}
+
+static const int bishop_dirs[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+static const int rook_dirs[4][2] = {{0, 1}, {0, -1}, {1, 0}, {-1, 0}};
+
+// Slider attacks are looked up by the occupancy of the squares that can block
+// the slider, i.e. its rays without their last square. Those relevant bits are
+// turned into a dense table index either by a magic multiply and shift, or by
+// PEXT, which extracts the bits directly.
+struct slider_table
+{
+    bitboard mask;
+    bitboard magic;
+    int shift;
+    bitboard *attacks;
+};
+
+static struct slider_table bishop_tables[64];
+static struct slider_table rook_tables[64];
+
+// 2^(relevant bits) entries per square, summed over the squares
+static bitboard bishop_attack_storage[5248];
+static bitboard rook_attack_storage[102400];
+
+static bool use_pext;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_PEXT 1
+#include <immintrin.h>
+
+__attribute__((target("bmi2")))
+static bitboard pext_lookup(const struct slider_table *table, bitboard occupied) {
+    return table->attacks[_pext_u64(occupied, table->mask)];
+}
+
+// PEXT is microcoded and far slower than a multiply on AMD CPUs before Zen 3
+static bool fast_pext_available(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("znver1") && !__builtin_cpu_is("znver2");
+}
+#else
+static bool fast_pext_available(void) {
+    return false;
+}
+#endif
+
+static inline bitboard slider_lookup(const struct slider_table *table, bitboard occupied) {
+#ifdef HAVE_PEXT
+    if (use_pext) {
+        return pext_lookup(table, occupied);
+    }
+#endif
+    return table->attacks[((occupied & table->mask) * table->magic) >> table->shift];
+}
+
+bitboard bishop_attacks(int square, bitboard occupied) {
+    return slider_lookup(&bishop_tables[square], occupied);
+}
+
+bitboard rook_attacks(int square, bitboard occupied) {
+    return slider_lookup(&rook_tables[square], occupied);
+}
+
+// Multipliers that send every relevant occupancy of the square to a slot of its own, or to one shared only with
+// occupancies that give the same attacks. Found once with a random search for sparse 64-bit numbers, which takes
+// too long to repeat at every startup.
+static const bitboard bishop_magics[64] = {
+    0x10102002004A1420ULL, 0x8020040400584008ULL, 0x10510800811201C8ULL, 0x5204042080000088ULL,
+    0x2204106880000002ULL, 0x1401042004000000ULL, 0x0400880410042004ULL, 0x0028208200A02020ULL,
+    0x1500241990010E00ULL, 0x8001200182020A40ULL, 0x40004101030B0000ULL, 0x8002041042000100ULL,
+    0x4010011041020038ULL, 0x0000010421044000ULL, 0x1500210808020A00ULL, 0x8000088400880520ULL,
+    0x0405004010040100ULL, 0x1005823210040108ULL, 0x2708008102040011ULL, 0x4048200404009100ULL,
+    0x0018104101400024ULL, 0x0003000601190101ULL, 0x8004803108491000ULL, 0x8014241200820800ULL,
+    0x0006E080100C3040ULL, 0x0501044A11041800ULL, 0x9020300008004045ULL, 0x0894080000220040ULL,
+    0x1001010083104000ULL, 0x5004030040900080ULL, 0x000400422C012400ULL, 0x0002128698404812ULL,
+    0x1010108404900440ULL, 0x0928021182084100ULL, 0x2006080409020024ULL, 0x1010202020180080ULL,
+    0xA010008200202200ULL, 0x2098015100019004ULL, 0x0002041440810811ULL, 0x802A02020000B098ULL,
+    0x0009015090004060ULL, 0x4000821082081001ULL, 0x0100210040420800ULL, 0x0800004010488A00ULL,
+    0x2000081104004040ULL, 0x4C8E029015000082ULL, 0x0420340322224842ULL, 0x1298260043400210ULL,
+    0x0000822802400008ULL, 0x00008A0101600000ULL, 0x3040003412080021ULL, 0x3040290220884800ULL,
+    0x4A1500401041004AULL, 0x8010200282020781ULL, 0x0020203142209091ULL, 0x0070300600902110ULL,
+    0x0040808800B62048ULL, 0x0000810400C44420ULL, 0x00080400440C0441ULL, 0x8340080020840411ULL,
+    0x0000000104208200ULL, 0x0000800810D00080ULL, 0x0400530411080200ULL, 0x4040702400932244ULL,
+};
+
+static const bitboard rook_magics[64] = {
+    0x1080004008801020ULL, 0x0840092002C03000ULL, 0x1900200010400900ULL, 0x0880100008000480ULL,
+    0x4200100420080200ULL, 0x8100020100080400ULL, 0x0200040110886200ULL, 0x0200008040220411ULL,
+    0x0404800084400220ULL, 0x0000401000402000ULL, 0x0086001081220440ULL, 0x0408800800100280ULL,
+    0x000A001201040820ULL, 0x8848800200840080ULL, 0x4001000100040200ULL, 0x0442000102105084ULL,
+    0x9080010020804100ULL, 0x0040404000201009ULL, 0x0000808010002009ULL, 0x2200090021D00100ULL,
+    0x0008008008040080ULL, 0x0004004002010040ULL, 0x0011040008015042ULL, 0x00000A0001768104ULL,
+    0x0000800080204009ULL, 0x2010004140002001ULL, 0x9800200280100080ULL, 0x1000100080080080ULL,
+    0x0442000A00049020ULL, 0x2100040080020080ULL, 0x0800120400900148ULL, 0x0010040A00128541ULL,
+    0x2800804000800030ULL, 0x1010002000400041ULL, 0x4000200011004100ULL, 0x0610008410800800ULL,
+    0x0400802402800800ULL, 0xC100020080800400ULL, 0x0002000802000401ULL, 0x0182085882000401ULL,
+    0x0220204000808000ULL, 0x2860100040024022ULL, 0x0001002004110040ULL, 0x99101042000A0020ULL,
+    0x0004080004008080ULL, 0x0010040002008080ULL, 0x2012004881020004ULL, 0x8300842444820011ULL,
+    0x0088403882010200ULL, 0x0820400080210100ULL, 0x0110910040A00300ULL, 0x0801100280080480ULL,
+    0x0242009008200600ULL, 0x1002000489500200ULL, 0x0040800200010080ULL, 0x0091800041000080ULL,
+    0x0000209300488001ULL, 0x04C1002414824001ULL, 0x020020000B001041ULL, 0x7000100004200901ULL,
+    0x8002002004100802ULL, 0x30010002084C0007ULL, 0x0888221800813004ULL, 0x4000002840840112ULL,
+};
+
+// Fills the tables of one slider type, laying the attacks of each square out one after the other in storage.
+static void init_slider_tables(struct slider_table tables[64], bitboard *storage, const bitboard magics[64],
+                               const int dirs[4][2]) {
+    for (int square = 0; square < 64; square++) {
+        struct slider_table *table = &tables[square];
+
+        // the last square of each ray is attacked whatever stands on it, so it never changes the attacks
+        const int x = SQUARE_FILE(square);
+        const int y = SQUARE_RANK(square);
+        const bitboard edges = ((RANK_1_MASK | RANK_8_MASK) & ~RANK_MASK(y)) |
+                               ((FILE_A_MASK | FILE_H_MASK) & ~FILE_MASK(x));
+        table->mask = slide(square, 0, dirs) & ~edges;
+
+        const int bits = bitboard_count(table->mask);
+        const int size = 1 << bits;
+        table->shift = 64 - bits;
+        table->attacks = storage;
+        storage += size;
+
+        table->magic = magics[square];
+
+        // Counting through the subsets this way visits them in the order of their PEXT index.
+        bitboard subset = 0;
+        for (int i = 0; i < size; i++) {
+            const int index = use_pext ? i : (int) ((subset * table->magic) >> table->shift);
+            table->attacks[index] = slide(square, subset, dirs);
+            subset = (subset - table->mask) & table->mask;
+        }
+    }
+}
+
+void bitboard_init(void) {
+    for (int square = 0; square < 64; square++) {
+        const bitboard b = SQUARE_BIT(square);
+
+        const bitboard one = shift_east(b) | shift_west(b);
+        const bitboard two = shift_east(shift_east(b)) | shift_west(shift_west(b));
+        knight_attack_table[square] = (one << 16) | (one >> 16) | (two << 8) | (two >> 8);
+
+        const bitboard row = b | one;
+        king_attack_table[square] = (row | (row << 8) | (row >> 8)) & ~b;
+
+        // white pawns capture up the board, black pawns down
+        pawn_attack_table[0][square] = shift_east(b << 8) | shift_west(b << 8);
+        pawn_attack_table[1][square] = shift_east(b >> 8) | shift_west(b >> 8);
+    }
+
+    use_pext = fast_pext_available();
+    init_slider_tables(bishop_tables, bishop_attack_storage, bishop_magics, bishop_dirs);
+    init_slider_tables(rook_tables, rook_attack_storage, rook_magics, rook_dirs);
+}
+
+bool bitboard_uses_pext(void) {
+    return use_pext;
+}
+
+bitboard queen_attacks(int square, bitboard occupied) {
+    return bishop_attacks(square, occupied) | rook_attacks(square, occupied);
+}
+
+bitboard squares_between(int a, int b) {
+    const bitboard ends = SQUARE_BIT(a) | SQUARE_BIT(b);
+    const int dx = SQUARE_FILE(b) - SQUARE_FILE(a);
+    const int dy = SQUARE_RANK(b) - SQUARE_RANK(a);
+
+    // with only the two end squares occupied, the squares both ends can see along the shared line are the ones
+    // between them
+    if (dx == 0 || dy == 0) {
+        return rook_attacks(a, ends) & rook_attacks(b, ends);
+    }
+    if (dx == dy || dx == -dy) {
+        return bishop_attacks(a, ends) & bishop_attacks(b, ends);
+    }
+    return 0;
+}
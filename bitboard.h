@@ -0,0 +1,90 @@
+#ifndef APSC143__BITBOARD_H
+#define APSC143__BITBOARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A set of squares, one bit per square. Bit n is square n = y * 8 + x, so a1
+// is bit 0, h1 is bit 7 and h8 is bit 63.
+typedef uint64_t bitboard;
+
+#define SQUARE(x, y) ((y) * 8 + (x))
+#define SQUARE_FILE(square) ((square) & 7)
+#define SQUARE_RANK(square) ((square) >> 3)
+#define SQUARE_BIT(square) ((bitboard) 1 << (square))
+
+#define FILE_A_MASK 0x0101010101010101ULL
+#define FILE_H_MASK 0x8080808080808080ULL
+#define RANK_1_MASK 0x00000000000000FFULL
+#define RANK_8_MASK 0xFF00000000000000ULL
+
+#define FILE_MASK(x) (FILE_A_MASK << (x))
+#define RANK_MASK(y) (RANK_1_MASK << ((y) * 8))
+
+// Index of the lowest set bit. The bitboard must not be empty.
+static inline int bitboard_lsb(bitboard b)
+{
+    return __builtin_ctzll(b);
+}
+
+// Removes the lowest set bit from *b and returns its index.
+static inline int bitboard_pop_lsb(bitboard *b)
+{
+    int square = __builtin_ctzll(*b);
+    *b &= *b - 1;
+    return square;
+}
+
+static inline int bitboard_count(bitboard b)
+{
+    return __builtin_popcountll(b);
+}
+
+// True if more than one bit is set.
+static inline bool bitboard_several(bitboard b)
+{
+    return (b & (b - 1)) != 0;
+}
+
+// Attacks of the pieces that do not slide, indexed by square, filled in by
+// bitboard_init.
+extern bitboard knight_attack_table[64];
+extern bitboard king_attack_table[64];
+extern bitboard pawn_attack_table[2][64]; // [colour][square]
+
+// Fills in the attack tables, including those for the sliding pieces. Must be
+// called before any of the functions below are used.
+void bitboard_init(void);
+
+// True if slider attacks are indexed with the BMI2 PEXT instruction rather
+// than magic multiplication. Decided by bitboard_init from the CPU it runs on.
+bool bitboard_uses_pext(void);
+
+// Squares attacked by a piece standing on the given square. Sliding pieces stop
+// at (and include) the first occupied square in each direction; their attacks
+// are a single table lookup.
+static inline bitboard knight_attacks(int square)
+{
+    return knight_attack_table[square];
+}
+
+static inline bitboard king_attacks(int square)
+{
+    return king_attack_table[square];
+}
+
+// colour is PLAYER_WHITE/PLAYER_BLACK
+static inline bitboard pawn_attacks(int square, int colour)
+{
+    return pawn_attack_table[colour][square];
+}
+
+bitboard bishop_attacks(int square, bitboard occupied);
+bitboard rook_attacks(int square, bitboard occupied);
+bitboard queen_attacks(int square, bitboard occupied);
+
+// Squares strictly between a and b when they share a rank, file or diagonal,
+// otherwise the empty set.
+bitboard squares_between(int a, int b);
+
+#endif
@@ -2,8 +2,11 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "movegen.h"
 #include "panic.h"
+#include "zobrist.h"
 #include <stdlib.h>
 
 const char *player_string(enum chess_player player) {
@@ -33,780 +36,597 @@ const char *piece_string(enum piece_type piece) {
     }
 }
 
-struct chess_piece empty_piece = {
-    .piece_type = PIECE_EMPTY,
-    .colour = PLAYER_EMPTY,
-};
-
-//intializes board with propper piece order as well as empty squares
-void board_initialize(struct chess_board *board) {
-    board->next_move_player = PLAYER_WHITE;
-
-    // Initialize all squares as empty
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
-            board->board_array[y][x] = empty_piece;
+// Rebuilds the bitboards, king squares and piece counts from the mailbox. Used
+// after the mailbox has been filled in directly, e.g. by board_initialize.
+static void board_sync_bitboards(struct chess_board *board) {
+    for (int i = 0; i < 6; i++) {
+        board->piece_bitboards[i] = 0;
+    }
+    board->colour_bitboards[PLAYER_WHITE] = 0;
+    board->colour_bitboards[PLAYER_BLACK] = 0;
+    memset(board->piece_counts, 0, sizeof(board->piece_counts));
+
+    for (int square = 0; square < 64; square++) {
+        piece_code p = board_piece_at(board, square);
+        if (p != PIECE_CODE_EMPTY) {
+            board->piece_bitboards[PIECE_CODE_TYPE(p)] |= SQUARE_BIT(square);
+            board->colour_bitboards[PIECE_CODE_COLOUR(p)] |= SQUARE_BIT(square);
+            board->piece_counts[PIECE_CODE_COLOUR(p)][PIECE_CODE_TYPE(p)]++;
+            if (PIECE_CODE_TYPE(p) == PIECE_KING) {
+                board->king_squares[PIECE_CODE_COLOUR(p)] = (uint8_t) square;
+            }
         }
     }
+}
 
-    // White pawns (rank 2)
-    for (int i = 0; i < 8; i++) {
-        board->board_array[1][i].piece_type = PIECE_PAWN;
-        board->board_array[1][i].colour = PLAYER_WHITE;
-    }
-
-    // Black pawns (rank 7)
-    for (int i = 0; i < 8; i++) {
-        board->board_array[6][i].piece_type = PIECE_PAWN;
-        board->board_array[6][i].colour = PLAYER_BLACK;
-    }
-
-    // White back rank (rank 1)
-    board->board_array[0][0].piece_type = PIECE_ROOK;
-    board->board_array[0][0].colour = PLAYER_WHITE;
-    board->board_array[0][1].piece_type = PIECE_KNIGHT;
-    board->board_array[0][1].colour = PLAYER_WHITE;
-    board->board_array[0][2].piece_type = PIECE_BISHOP;
-    board->board_array[0][2].colour = PLAYER_WHITE;
-    board->board_array[0][3].piece_type = PIECE_QUEEN;
-    board->board_array[0][3].colour = PLAYER_WHITE;
-    board->board_array[0][4].piece_type = PIECE_KING;
-    board->board_array[0][4].colour = PLAYER_WHITE;
-    board->board_array[0][5].piece_type = PIECE_BISHOP;
-    board->board_array[0][5].colour = PLAYER_WHITE;
-    board->board_array[0][6].piece_type = PIECE_KNIGHT;
-    board->board_array[0][6].colour = PLAYER_WHITE;
-    board->board_array[0][7].piece_type = PIECE_ROOK;
-    board->board_array[0][7].colour = PLAYER_WHITE;
-
-    // Black back rank (rank 8)
-    board->board_array[7][0].piece_type = PIECE_ROOK;
-    board->board_array[7][0].colour = PLAYER_BLACK;
-    board->board_array[7][1].piece_type = PIECE_KNIGHT;
-    board->board_array[7][1].colour = PLAYER_BLACK;
-    board->board_array[7][2].piece_type = PIECE_BISHOP;
-    board->board_array[7][2].colour = PLAYER_BLACK;
-    board->board_array[7][3].piece_type = PIECE_QUEEN;
-    board->board_array[7][3].colour = PLAYER_BLACK;
-    board->board_array[7][4].piece_type = PIECE_KING;
-    board->board_array[7][4].colour = PLAYER_BLACK;
-    board->board_array[7][5].piece_type = PIECE_BISHOP;
-    board->board_array[7][5].colour = PLAYER_BLACK;
-    board->board_array[7][6].piece_type = PIECE_KNIGHT;
-    board->board_array[7][6].colour = PLAYER_BLACK;
-    board->board_array[7][7].piece_type = PIECE_ROOK;
-    board->board_array[7][7].colour = PLAYER_BLACK;
+// Places a piece on an empty square, updating the mailbox, the bitboards and the hash.
+static void board_put_piece(struct chess_board *board, int square, piece_code piece) {
+    const enum piece_type type = PIECE_CODE_TYPE(piece);
+    const enum chess_player colour = PIECE_CODE_COLOUR(piece);
+    board->squares[square] = piece;
+    board->piece_bitboards[type] |= SQUARE_BIT(square);
+    board->colour_bitboards[colour] |= SQUARE_BIT(square);
+    board->piece_counts[colour][type]++;
+    board->hash ^= zobrist_pieces[colour][type][square];
+    if (type == PIECE_KING) {
+        board->king_squares[colour] = (uint8_t) square;
+    }
 }
 
+// Empties a square, returning whatever piece stood on it.
+static piece_code board_remove_piece(struct chess_board *board, int square) {
+    const piece_code piece = board_piece_at(board, square);
+    if (piece != PIECE_CODE_EMPTY) {
+        const enum piece_type type = PIECE_CODE_TYPE(piece);
+        const enum chess_player colour = PIECE_CODE_COLOUR(piece);
+        board->piece_bitboards[type] &= ~SQUARE_BIT(square);
+        board->colour_bitboards[colour] &= ~SQUARE_BIT(square);
+        board->piece_counts[colour][type]--;
+        board->squares[square] = PIECE_CODE_EMPTY;
+        board->hash ^= zobrist_pieces[colour][type][square];
+    }
+    return piece;
+}
 
-// fills out necessary fields of the given move struct so the apply move function will know exactly which piece is
-//moving and if it is actually legal
-void board_complete_move(const struct chess_board *board, struct chess_move *move) {
-    const struct chess_piece target = board->board_array[move->target_square_y][move->target_square_x];
+static void board_move_piece(struct chess_board *board, int from, int to) {
+    board_put_piece(board, to, board_remove_piece(board, from));
+}
 
-    // Error if target square contains a piece of the same colour
-    if (target.piece_type != PIECE_EMPTY && target.colour == board->next_move_player) {
-        panicf("move completion error: %s %s to %c%d (same colour on target)",
-               player_string(board->next_move_player),
-               piece_string(move->piece_type),
-               'a' + move->target_square_x,
-               move->target_square_y + 1);
+void board_init_tables(void) {
+    bitboard_init();
+    zobrist_init();
+}
+
+uint64_t board_compute_hash(const struct chess_board *board) {
+    uint64_t hash = 0;
+    for (int colour = PLAYER_WHITE; colour <= PLAYER_BLACK; colour++) {
+        for (int piece = PIECE_PAWN; piece <= PIECE_KING; piece++) {
+            bitboard pieces = board_pieces(board, colour, piece);
+            while (pieces) {
+                hash ^= zobrist_pieces[colour][piece][bitboard_pop_lsb(&pieces)];
+            }
+        }
+    }
+    hash ^= zobrist_castling[board->castling_rights];
+    if (board->en_passant_square != NO_SQUARE) {
+        hash ^= zobrist_en_passant[SQUARE_FILE(board->en_passant_square)];
+    }
+    if (board->next_move_player == PLAYER_BLACK) {
+        hash ^= zobrist_black_to_move;
     }
+    return hash;
+}
 
-    // Pawn moves
-    if (move->piece_type == PIECE_PAWN) {
-        if (move->capture) {
+//intializes board with propper piece order as well as empty squares
+void board_initialize(struct chess_board *board) {
+    static const enum piece_type back_rank[8] = {
+        PIECE_ROOK, PIECE_KNIGHT, PIECE_BISHOP, PIECE_QUEEN, PIECE_KING, PIECE_BISHOP, PIECE_KNIGHT, PIECE_ROOK,
+    };
 
-            // throws error if there isn't a pawn to capture
-            if (target.piece_type == PIECE_EMPTY) {
-                panicf("move completion error: %s %s to %c%d (capture on empty square)",
-                       player_string(board->next_move_player),
-                       piece_string(move->piece_type),
-                       'a' + move->target_square_x,
-                       move->target_square_y + 1);
-            }
+    board->next_move_player = PLAYER_WHITE;
 
-            // candidates array stores the file of a pawn that is available to make the move and the count variable
-            //keeps track of how many candidates have been found
-            int candidates[2] = {-1, -1};
-            int count = 0;
-
-            // finds candidates based on which colour is capturing
-            if (board->next_move_player == PLAYER_WHITE) {
-                if (move->target_square_x > 0 &&
-                    board->board_array[move->target_square_y - 1][move->target_square_x - 1].piece_type == PIECE_PAWN &&
-                    board->board_array[move->target_square_y - 1][move->target_square_x - 1].colour == PLAYER_WHITE) {
-                    candidates[count++] = move->target_square_x - 1;
-                }
-                if (move->target_square_x < 7 &&
-                    board->board_array[move->target_square_y - 1][move->target_square_x + 1].piece_type == PIECE_PAWN &&
-                    board->board_array[move->target_square_y - 1][move->target_square_x + 1].colour == PLAYER_WHITE) {
-                    candidates[count++] = move->target_square_x + 1;
-                }
-            } else {
-                if (move->target_square_x > 0 &&
-                    board->board_array[move->target_square_y + 1][move->target_square_x - 1].piece_type == PIECE_PAWN &&
-                    board->board_array[move->target_square_y + 1][move->target_square_x - 1].colour == PLAYER_BLACK) {
-                    candidates[count++] = move->target_square_x - 1;
-                }
-                if (move->target_square_x < 7 &&
-                    board->board_array[move->target_square_y + 1][move->target_square_x + 1].piece_type == PIECE_PAWN &&
-                    board->board_array[move->target_square_y + 1][move->target_square_x + 1].colour == PLAYER_BLACK) {
-                    candidates[count++] = move->target_square_x + 1;
-                }
-            }
+    // Initialize all squares as empty
+    memset(board->squares, PIECE_CODE_EMPTY, sizeof(board->squares));
 
-            //throws error if there are no pawns that can preform the capture
-            if (count == 0) {
-                panicf("move completion error: %s %s to %c%d (no pawn can capture)",
-                       player_string(board->next_move_player),
-                       piece_string(move->piece_type),
-                       'a' + move->target_square_x,
-                       move->target_square_y + 1);
-            }
+    for (int x = 0; x < 8; x++) {
+        board->squares[SQUARE(x, 0)] = PIECE_CODE(PLAYER_WHITE, back_rank[x]); // rank 1
+        board->squares[SQUARE(x, 1)] = PIECE_CODE(PLAYER_WHITE, PIECE_PAWN);   // rank 2
+        board->squares[SQUARE(x, 6)] = PIECE_CODE(PLAYER_BLACK, PIECE_PAWN);   // rank 7
+        board->squares[SQUARE(x, 7)] = PIECE_CODE(PLAYER_BLACK, back_rank[x]); // rank 8
+    }
+    board->castling_rights = CASTLING_WHITE_KINGSIDE | CASTLING_WHITE_QUEENSIDE |
+                             CASTLING_BLACK_KINGSIDE | CASTLING_BLACK_QUEENSIDE;
+    board->en_passant_square = NO_SQUARE;
+    board->halfmove_clock = 0;
+    board->fullmove_number = 1;
+    board->ply = 0;
+    board_sync_bitboards(board);
+    board->hash = board_compute_hash(board);
+}
 
-            // throws error if 2 pawns can capture and the origin file wasn't specified
-            else if (count > 1 && move->source_x == -1) {
-                panicf("move completion error: %s %s to %c%d (ambiguous capture, source file not specified)",
-                       player_string(board->next_move_player),
-                       piece_string(move->piece_type),
-                       'a' + move->target_square_x,
-                       move->target_square_y + 1);
-            }
+void board_copy(struct chess_board *board, const struct chess_board *from) {
+    memcpy(board, from, offsetof(struct chess_board, history));
 
-            // fills out source_x and source_y
-            else {
-                int src_file = (count == 1) ? candidates[0] : move->source_x;
-                int src_rank = (board->next_move_player == PLAYER_WHITE) ? move->target_square_y - 1: move->target_square_y + 1;
-                move->source_x = src_file;
-                move->source_y = src_rank;
-                move->moving_piece = board->board_array[src_rank][src_file];
+    // the same positions board_repetitions looks back over
+    int back = from->halfmove_clock;
+    if (back > from->ply) back = from->ply;
+    if (back > BOARD_HISTORY_SIZE) back = BOARD_HISTORY_SIZE;
+    for (int i = 1; i <= back; i++) {
+        const int slot = (from->ply - i) % BOARD_HISTORY_SIZE;
+        board->history[slot] = from->history[slot];
+    }
+}
+
+// Sets up the board from a FEN string. The move counters are optional and default to 0 and 1.
+bool board_from_fen(struct chess_board *board, const char *fen) {
+    // Initialize all squares as empty
+    memset(board->squares, PIECE_CODE_EMPTY, sizeof(board->squares));
+
+    // piece placement, from rank 8 down to rank 1
+    int x = 0, y = 7;
+    for (; *fen != ' '; fen++) {
+        char c = *fen;
+        if (c == '/') {
+            if (x != 8 || y == 0) return false;
+            x = 0;
+            y--;
+        } else if (c >= '1' && c <= '8') {
+            x += c - '0';
+            if (x > 8) return false;
+        } else {
+            enum chess_player colour = (c >= 'a' && c <= 'z') ? PLAYER_BLACK : PLAYER_WHITE;
+            enum piece_type type;
+            switch (c | 0x20) { // lowercase
+                case 'p': type = PIECE_PAWN; break;
+                case 'n': type = PIECE_KNIGHT; break;
+                case 'b': type = PIECE_BISHOP; break;
+                case 'r': type = PIECE_ROOK; break;
+                case 'q': type = PIECE_QUEEN; break;
+                case 'k': type = PIECE_KING; break;
+                default: return false;
             }
+            if (x > 7) return false;
+            board->squares[SQUARE(x++, y)] = PIECE_CODE(colour, type);
         }
+    }
+    if (x != 8 || y != 0) return false;
+    board_sync_bitboards(board);
 
-        // if move isn't a capture
-        else {
-            if (board->next_move_player == PLAYER_WHITE) {
-                // checks below target square to ensure a movable pawn is there
-                if (board->board_array[move->target_square_y - 1][move->target_square_x].piece_type == PIECE_PAWN &&
-                    board->board_array[move->target_square_y - 1][move->target_square_x].colour == PLAYER_WHITE) {
-                    move->source_x = move->target_square_x;
-                    move->source_y = move->target_square_y - 1;
-                    move->moving_piece = board->board_array[move->source_y][move->source_x];
-                    }
-                //checks case that pawn moves 2 squares to the 4th row from it's starting position
-                else if (move->target_square_y == 3 &&
-                           board->board_array[2][move->target_square_x].piece_type == PIECE_EMPTY &&
-                           board->board_array[1][move->target_square_x].piece_type == PIECE_PAWN &&
-                           board->board_array[1][move->target_square_x].colour == PLAYER_WHITE) {
-                    move->source_x = move->target_square_x;
-                    move->source_y = 1;
-                    move->moving_piece = board->board_array[move->source_y][move->source_x];
-                           }
-
-                else {
-                    panicf("move completion error: WHITE PAWN to %c%d (no pawn can move)",
-                           'a' + move->target_square_x, move->target_square_y + 1);
-                }
-            }
+    // each side needs exactly one king
+    if (bitboard_count(board_pieces(board, PLAYER_WHITE, PIECE_KING)) != 1 ||
+        bitboard_count(board_pieces(board, PLAYER_BLACK, PIECE_KING)) != 1) {
+        return false;
+    }
 
-            // standard pawn move for black pawns
-            // same code as white pawns just scanning in the opposite direction
-            else {
-                if (board->board_array[move->target_square_y + 1][move->target_square_x].piece_type == PIECE_PAWN &&
-                    board->board_array[move->target_square_y + 1][move->target_square_x].colour == PLAYER_BLACK) {
-                    move->source_x = move->target_square_x;
-                    move->source_y = move->target_square_y + 1;
-                    move->moving_piece = board->board_array[move->source_y][move->source_x];
-                } else if (move->target_square_y == 4 &&
-                           board->board_array[5][move->target_square_x].piece_type == PIECE_EMPTY &&
-                           board->board_array[6][move->target_square_x].piece_type == PIECE_PAWN &&
-                           board->board_array[6][move->target_square_x].colour == PLAYER_BLACK) {
-                    move->source_x = move->target_square_x;
-                    move->source_y = 6;
-                    move->moving_piece = board->board_array[move->source_y][move->source_x];
-                } else {
-                    panicf("move completion error: BLACK PAWN to %c%d (no pawn can move)",
-                           'a' + move->target_square_x, move->target_square_y + 1);
-                }
-            }
+    // a pawn can never stand on the first or last rank: it would have promoted, or could never have got there
+    if (board->piece_bitboards[PIECE_PAWN] & (RANK_1_MASK | RANK_8_MASK)) {
+        return false;
+    }
+
+    // each side starts with sixteen pieces, eight of them pawns, and can only gain a piece by promoting a pawn
+    for (int colour = PLAYER_WHITE; colour <= PLAYER_BLACK; colour++) {
+        int counts[6];
+        for (int type = PIECE_PAWN; type <= PIECE_KING; type++) {
+            counts[type] = bitboard_count(board_pieces(board, (enum chess_player) colour, (enum piece_type) type));
+        }
+        int promoted = (counts[PIECE_KNIGHT] > 2 ? counts[PIECE_KNIGHT] - 2 : 0) +
+                       (counts[PIECE_BISHOP] > 2 ? counts[PIECE_BISHOP] - 2 : 0) +
+                       (counts[PIECE_ROOK] > 2 ? counts[PIECE_ROOK] - 2 : 0) +
+                       (counts[PIECE_QUEEN] > 1 ? counts[PIECE_QUEEN] - 1 : 0);
+        if (bitboard_count(board->colour_bitboards[colour]) > 16 || counts[PIECE_PAWN] > 8 ||
+            promoted > 8 - counts[PIECE_PAWN]) {
+            return false;
         }
     }
 
+    // side to move
+    fen++;
+    if (*fen == 'w') {
+        board->next_move_player = PLAYER_WHITE;
+    } else if (*fen == 'b') {
+        board->next_move_player = PLAYER_BLACK;
+    } else {
+        return false;
+    }
+    fen++;
+    if (*fen++ != ' ') return false;
 
-//
-else if (move->piece_type == PIECE_ROOK) {
-     //target square must be empty or contain opponent piece
-    struct chess_piece target_piece = board->board_array[move->target_square_y][move->target_square_x];
-    if (target_piece.piece_type != PIECE_EMPTY && target_piece.colour == board->next_move_player) {
-        panicf("illegal move: %s rook to %c%d (own piece on target)",
-               player_string(board->next_move_player),
-               'a' + move->target_square_x, move->target_square_y + 1);
-    }
-
-    bool rook_found = false;
-
-    // If source file is given, scan that file for a rook of the correct colour
-    if (move->source_x != -1 && move->source_y == -1) {
-        for (int row = 0; row < 8 && !rook_found; row++) {
-            struct chess_piece candidate = board->board_array[row][move->source_x];
-            if (candidate.piece_type == PIECE_ROOK && candidate.colour == board->next_move_player) {
-                bool path_clear = false;
-
-                if (move->source_x == move->target_square_x) {
-                    // Vertical move on same file
-                    int step = (move->target_square_y > row) ? 1 : -1;
-                    path_clear = true;
-                    // ensures the path is clear from the rook that was found to the target square
-                    for (int check_row = row + step; check_row != move->target_square_y; check_row += step) {
-                        if (board->board_array[check_row][move->source_x].piece_type != PIECE_EMPTY) {
-                            path_clear = false; break;
-                        }
-                    }
-                } else if (row == move->target_square_y) {
-                    // Horizontal move on same rank
-                    int step = (move->target_square_x > move->source_x) ? 1 : -1;
-                    path_clear = true;
-                    // ensures the path is clear from the rook that was found to the target square
-                    for (int check_col = move->source_x + step; check_col != move->target_square_x; check_col += step) {
-                        if (board->board_array[move->target_square_y][check_col].piece_type != PIECE_EMPTY) {
-                            path_clear = false; break;
-                        }
-                    }
-                }
-
-                if (path_clear) {
-                    move->source_y = row;
-                    move->moving_piece = candidate;
-                    rook_found = true;
-                }
+    // castling rights
+    board->castling_rights = 0;
+    if (*fen == '-') {
+        fen++;
+    } else {
+        for (; *fen && *fen != ' '; fen++) {
+            switch (*fen) {
+                case 'K': board->castling_rights |= CASTLING_WHITE_KINGSIDE; break;
+                case 'Q': board->castling_rights |= CASTLING_WHITE_QUEENSIDE; break;
+                case 'k': board->castling_rights |= CASTLING_BLACK_KINGSIDE; break;
+                case 'q': board->castling_rights |= CASTLING_BLACK_QUEENSIDE; break;
+                default: return false;
             }
         }
     }
-
-    // if source rank was given
-    // similar function to when the file is given
-    else if (move->source_y != -1 && move->source_x == -1) {
-        for (int col = 0; col < 8 && !rook_found; col++) {
-            struct chess_piece candidate = board->board_array[move->source_y][col];
-            if (candidate.piece_type == PIECE_ROOK && candidate.colour == board->next_move_player) {
-                bool path_clear = false;
-
-                if (move->source_y == move->target_square_y) {
-                    // Horizontal move on same rank
-                    int step = (move->target_square_x > col) ? 1 : -1;
-                    path_clear = true;
-                    for (int check_col = col + step; check_col != move->target_square_x; check_col += step) {
-                        if (board->board_array[move->source_y][check_col].piece_type != PIECE_EMPTY) {
-                            path_clear = false; break;
-                        }
-                    }
-                } else if (col == move->target_square_x) {
-                    // Vertical move on same file
-                    int step = (move->target_square_y > move->source_y) ? 1 : -1;
-                    path_clear = true;
-                    for (int check_row = move->source_y + step; check_row != move->target_square_y; check_row += step) {
-                        if (board->board_array[check_row][move->target_square_x].piece_type != PIECE_EMPTY) {
-                            path_clear = false; break;
-                        }
-                    }
-                }
-
-                if (path_clear) {
-                    move->source_x = col;
-                    move->moving_piece = candidate;
-                    rook_found = true;
-                }
-            }
+    if (*fen++ != ' ') return false;
+
+    // a right whose king or rook has left its home square can never be used, and castling with it would move a
+    // piece that is not there, so it is dropped
+    static const struct { uint8_t right; int king; int rook; enum chess_player colour; } homes[4] = {
+        {CASTLING_WHITE_KINGSIDE, SQUARE(4, 0), SQUARE(7, 0), PLAYER_WHITE},
+        {CASTLING_WHITE_QUEENSIDE, SQUARE(4, 0), SQUARE(0, 0), PLAYER_WHITE},
+        {CASTLING_BLACK_KINGSIDE, SQUARE(4, 7), SQUARE(7, 7), PLAYER_BLACK},
+        {CASTLING_BLACK_QUEENSIDE, SQUARE(4, 7), SQUARE(0, 7), PLAYER_BLACK},
+    };
+    for (int i = 0; i < 4; i++) {
+        if (board_piece_at(board, homes[i].king) != PIECE_CODE(homes[i].colour, PIECE_KING) ||
+            board_piece_at(board, homes[i].rook) != PIECE_CODE(homes[i].colour, PIECE_ROOK)) {
+            board->castling_rights &= (uint8_t) ~homes[i].right;
         }
     }
 
-    //If no source is given at all
-    // Scan outward from the target square in all four directions until a rook is found
-    else {
-        // Scan left
-        for (int col = move->target_square_x - 1; col >= 0 && !rook_found; col--) {
-            struct chess_piece candidate = board->board_array[move->target_square_y][col];
-            if (candidate.piece_type != PIECE_EMPTY) {
-                if (candidate.piece_type == PIECE_ROOK && candidate.colour == board->next_move_player) {
-                    bool path_clear = true;
-                    for (int check_col = col + 1; check_col < move->target_square_x; check_col++) {
-                        if (board->board_array[move->target_square_y][check_col].piece_type != PIECE_EMPTY) {
-                            path_clear = false; break;
-                        }
-                    }
-                    if (path_clear) {
-                        move->source_x = col;
-                        move->source_y = move->target_square_y;
-                        move->moving_piece = candidate;
-                        rook_found = true;
-                    }
-                }
-                break; // stop scanning once a piece is encountered
-            }
+    // en passant square
+    board->en_passant_square = NO_SQUARE;
+    if (*fen == '-') {
+        fen++;
+    } else if (fen[0] >= 'a' && fen[0] <= 'h' && fen[1] == (board->next_move_player == PLAYER_WHITE ? '6' : '3')) {
+        // the square must be the one the last move's double push skipped: it and the pawn's start square are
+        // empty, and the pawn stands in front of it
+        const int skipped = SQUARE(fen[0] - 'a', fen[1] - '1');
+        const enum chess_player mover = board->next_move_player == PLAYER_WHITE ? PLAYER_BLACK : PLAYER_WHITE;
+        const int forward = mover == PLAYER_WHITE ? 8 : -8;
+        if (board_piece_at(board, skipped) != PIECE_CODE_EMPTY ||
+            board_piece_at(board, skipped - forward) != PIECE_CODE_EMPTY ||
+            board_piece_at(board, skipped + forward) != PIECE_CODE(mover, PIECE_PAWN)) {
+            return false;
         }
-
-        // Scan right
-        for (int col = move->target_square_x + 1; col < 8 && !rook_found; col++) {
-            struct chess_piece candidate = board->board_array[move->target_square_y][col];
-            if (candidate.piece_type != PIECE_EMPTY) {
-                if (candidate.piece_type == PIECE_ROOK && candidate.colour == board->next_move_player) {
-                    bool path_clear = true;
-                    for (int check_col = col - 1; check_col > move->target_square_x; check_col--) {
-                        if (board->board_array[move->target_square_y][check_col].piece_type != PIECE_EMPTY) {
-                            path_clear = false; break;
-                        }
-                    }
-                    if (path_clear) {
-                        move->source_x = col;
-                        move->source_y = move->target_square_y;
-                        move->moving_piece = candidate;
-                        rook_found = true;
-                    }
-                }
-                break;
-            }
+        // kept only if a pawn can take en passant, as board_make_move does
+        if (pawn_attacks(skipped, mover) & board_pieces(board, board->next_move_player, PIECE_PAWN)) {
+            board->en_passant_square = (int8_t) skipped;
         }
+        fen += 2;
+    } else {
+        return false;
+    }
+    // halfmove clock and fullmove number
+    board->halfmove_clock = 0;
+    board->fullmove_number = 1;
+    if (*fen == ' ') {
+        char *end;
+        unsigned long halfmove = strtoul(fen + 1, &end, 10);
+        if (end == fen + 1 || *end != ' ' || halfmove > UINT16_MAX) return false;
+        fen = end + 1;
+        unsigned long fullmove = strtoul(fen, &end, 10);
+        if (end == fen || fullmove < 1 || fullmove > UINT16_MAX) return false;
+        fen = end;
+        board->halfmove_clock = (uint16_t) halfmove;
+        board->fullmove_number = (uint16_t) fullmove;
+    }
+    if (*fen != '\0' && *fen != ' ' && *fen != '\n' && *fen != '\r') return false;
 
-        // Scan downward
-        for (int row = move->target_square_y - 1; row >= 0 && !rook_found; row--) {
-            struct chess_piece candidate = board->board_array[row][move->target_square_x];
-            if (candidate.piece_type != PIECE_EMPTY) {
-                if (candidate.piece_type == PIECE_ROOK && candidate.colour == board->next_move_player) {
-                    bool path_clear = true;
-                    for (int check_row = row + 1; check_row < move->target_square_y; check_row++) {
-                        if (board->board_array[check_row][move->target_square_x].piece_type != PIECE_EMPTY) {
-                            path_clear = false; break;
-                        }
-                    }
-                    if (path_clear) {
-                        move->source_x = move->target_square_x;
-                        move->source_y = row;
-                        move->moving_piece = candidate;
-                        rook_found = true;
-                    }
-                }
-                break;
-            }
-        }
+    // the moves before the position are not known, so it has no history
+    board->ply = 0;
+
+    // the side that just moved cannot have left its king in check
+    enum chess_player waiting = board->next_move_player == PLAYER_WHITE ? PLAYER_BLACK : PLAYER_WHITE;
+    if (is_in_check(board, waiting)) return false;
 
-        // Scan upward
-        for (int row = move->target_square_y + 1; row < 8 && !rook_found; row++) {
-            struct chess_piece candidate = board->board_array[row][move->target_square_x];
-            if (candidate.piece_type != PIECE_EMPTY) {
-                if (candidate.piece_type == PIECE_ROOK && candidate.colour == board->next_move_player) {
-                    bool path_clear = true;
-                    for (int check_row = row - 1; check_row > move->target_square_y; check_row--) {
-                        if (board->board_array[check_row][move->target_square_x].piece_type != PIECE_EMPTY) {
-                            path_clear = false; break;
-                        }
-                    }
-                    if (path_clear) {
-                        move->source_x = move->target_square_x;
-                        move->source_y = row;
-                        move->moving_piece = candidate;
-                        rook_found = true;
-                    }
-                }
-                break;
+    board->hash = board_compute_hash(board);
+    return true;
+}
+
+size_t board_to_fen(const struct chess_board *board, char *buffer, size_t size) {
+    char fen[BOARD_FEN_MAX];
+    size_t n = 0;
+
+    // piece placement, from rank 8 down to rank 1, with runs of empty squares as digits
+    for (int y = 7; y >= 0; y--) {
+        int empty = 0;
+        for (int x = 0; x < 8; x++) {
+            piece_code p = board_piece_at(board, SQUARE(x, y));
+            if (p == PIECE_CODE_EMPTY) {
+                empty++;
+                continue;
+            }
+            if (empty > 0) {
+                fen[n++] = (char) ('0' + empty);
+                empty = 0;
             }
+            char c = piece_char(p);
+            fen[n++] = PIECE_CODE_COLOUR(p) == PLAYER_BLACK ? (char) (c | 0x20) : c; // black is lowercase
+        }
+        if (empty > 0) {
+            fen[n++] = (char) ('0' + empty);
+        }
+        if (y > 0) {
+            fen[n++] = '/';
         }
     }
 
-    // --- Finalize ---
-    if (!rook_found) {
-        panicf("move completion error: %s rook to %c%d (no rook can move)",
-               player_string(board->next_move_player),
-               'a' + move->target_square_x, move->target_square_y + 1);
-    }
-}
-
-    else if (move->piece_type == PIECE_BISHOP) {
-        int src_x = -1, src_y = -1;
-        int found = 0;
-
-        // Scan diagonals
-        int dirs[4][2] = {{-1, 1}, {1, 1}, {-1, -1}, {1, -1}};
-        for (int d = 0; d < 4; d++) {
-            int dx = dirs[d][0], dy = dirs[d][1];
-            int x = move->target_square_x + dx;
-            int y = move->target_square_y + dy;
-            while (x >= 0 && x < 8 && y >= 0 && y < 8) {
-                struct chess_piece p = board->board_array[y][x];
-                if (p.piece_type != PIECE_EMPTY) {
-                    if (p.piece_type == PIECE_BISHOP && p.colour == board->next_move_player) {
-                        // Candidate found
-                        if (found == 0) {
-                            src_x = x;
-                            src_y = y;
-                        }
-                        found++;
-                    }
-                    break; // stop scanning this direction
-                }
-                x += dx;
-                y += dy;
-            }
-        }
+    fen[n++] = ' ';
+    fen[n++] = board->next_move_player == PLAYER_WHITE ? 'w' : 'b';
 
-        if (found == 0) {
-            panicf("move completion error: %s bishop to %c%d (no bishop can move)",
-                   player_string(board->next_move_player),
-                   'a' + move->target_square_x,
-                   move->target_square_y + 1);
-        } else if (found > 1) {
-            // Use disambiguation if provided
-            if (move->source_x != -1 || move->source_y != -1) {
-                bool matched = false;
-                for (int d = 0; d < 4; d++) {
-                    int dx = dirs[d][0], dy = dirs[d][1];
-                    int x = move->target_square_x + dx;
-                    int y = move->target_square_y + dy;
-                    while (x >= 0 && x < 8 && y >= 0 && y < 8) {
-                        struct chess_piece p = board->board_array[y][x];
-                        if (p.piece_type != PIECE_EMPTY) {
-                            if (p.piece_type == PIECE_BISHOP && p.colour == board->next_move_player) {
-                                if ((move->source_x == -1 || move->source_x == x) &&
-                                    (move->source_y == -1 || move->source_y == y)) {
-                                    src_x = x;
-                                    src_y = y;
-                                    matched = true;
-                                }
-                            }
-                            break;
-                        }
-                        x += dx;
-                        y += dy;
-                    }
-                }
-                if (!matched) {
-                    panicf("move completion error: %s bishop to %c%d (disambiguation does not match any bishop)",
-                           player_string(board->next_move_player),
-                           'a' + move->target_square_x,
-                           move->target_square_y + 1);
-                }
-            } else {
-                panicf("move completion error: %s bishop to %c%d (ambiguous bishop move, source not specified)",
-                       player_string(board->next_move_player),
-                       'a' + move->target_square_x,
-                       move->target_square_y + 1);
-            }
-        }
+    fen[n++] = ' ';
+    if (board->castling_rights == 0) {
+        fen[n++] = '-';
+    } else {
+        if (board->castling_rights & CASTLING_WHITE_KINGSIDE) fen[n++] = 'K';
+        if (board->castling_rights & CASTLING_WHITE_QUEENSIDE) fen[n++] = 'Q';
+        if (board->castling_rights & CASTLING_BLACK_KINGSIDE) fen[n++] = 'k';
+        if (board->castling_rights & CASTLING_BLACK_QUEENSIDE) fen[n++] = 'q';
+    }
 
-        // Finalize
-        move->source_x = src_x;
-        move->source_y = src_y;
-        move->moving_piece = board->board_array[src_y][src_x];
-    } else if (move->piece_type == PIECE_QUEEN) {
-        int src_x = -1, src_y = -1;
-        int found = 0;
-
-        // Directions: rook + bishop
-        int dirs[8][2] = {
-            {-1, 0}, {1, 0}, {0, -1}, {0, 1}, // rook directions
-            {-1, 1}, {1, 1}, {-1, -1}, {1, -1} // bishop directions
-        };
-
-        // Scan all 8 directions
-        for (int d = 0; d < 8; d++) {
-            int dx = dirs[d][0], dy = dirs[d][1];
-            int x = move->target_square_x + dx;
-            int y = move->target_square_y + dy;
-            while (x >= 0 && x < 8 && y >= 0 && y < 8) {
-                struct chess_piece p = board->board_array[y][x];
-                if (p.piece_type != PIECE_EMPTY) {
-                    if (p.piece_type == PIECE_QUEEN && p.colour == board->next_move_player) {
-                        // Candidate queen found
-                        if (found == 0) {
-                            src_x = x;
-                            src_y = y;
-                        }
-                        found++;
-                    }
-                    break; // stop scanning this direction
-                }
-                x += dx;
-                y += dy;
-            }
-        }
+    fen[n++] = ' ';
+    if (board->en_passant_square == NO_SQUARE) {
+        fen[n++] = '-';
+    } else {
+        fen[n++] = (char) ('a' + SQUARE_FILE(board->en_passant_square));
+        fen[n++] = (char) ('1' + SQUARE_RANK(board->en_passant_square));
+    }
 
-        if (found == 0) {
-            panicf("move completion error: %s queen to %c%d (no queen can move)",
-                   player_string(board->next_move_player),
-                   'a' + move->target_square_x,
-                   move->target_square_y + 1);
-        } else if (found > 1) {
-            // Use disambiguation if provided
-            if (move->source_x != -1 || move->source_y != -1) {
-                bool matched = false;
-                for (int d = 0; d < 8; d++) {
-                    int dx = dirs[d][0], dy = dirs[d][1];
-                    int x = move->target_square_x + dx;
-                    int y = move->target_square_y + dy;
-                    while (x >= 0 && x < 8 && y >= 0 && y < 8) {
-                        struct chess_piece p = board->board_array[y][x];
-                        if (p.piece_type != PIECE_EMPTY) {
-                            if (p.piece_type == PIECE_QUEEN && p.colour == board->next_move_player) {
-                                if ((move->source_x == -1 || move->source_x == x) &&
-                                    (move->source_y == -1 || move->source_y == y)) {
-                                    src_x = x;
-                                    src_y = y;
-                                    matched = true;
-                                }
-                            }
-                            break;
-                        }
-                        x += dx;
-                        y += dy;
-                    }
-                }
-                if (!matched) {
-                    panicf("move completion error: %s queen to %c%d (disambiguation does not match any queen)",
-                           player_string(board->next_move_player),
-                           'a' + move->target_square_x,
-                           move->target_square_y + 1);
-                }
-            } else {
-                panicf("move completion error: %s queen to %c%d (ambiguous queen move, source not specified)",
-                       player_string(board->next_move_player),
-                       'a' + move->target_square_x,
-                       move->target_square_y + 1);
-            }
-        }
+    n += (size_t) snprintf(fen + n, sizeof(fen) - n, " %u %u", board->halfmove_clock, board->fullmove_number);
 
-        // Finalize
-        move->source_x = src_x;
-        move->source_y = src_y;
-        move->moving_piece = board->board_array[src_y][src_x];
-    } else if (move->piece_type == PIECE_KNIGHT) {
-        int src_x = -1, src_y = -1;
-        int found = 0;
-
-        // All 8 knight move offsets
-        int offsets[8][2] = {
-            {1, 2}, {2, 1}, {-1, 2}, {-2, 1},
-            {1, -2}, {2, -1}, {-1, -2}, {-2, -1}
-        };
-
-        for (int i = 0; i < 8; i++) {
-            int x = move->target_square_x + offsets[i][0];
-            int y = move->target_square_y + offsets[i][1];
-            if (x >= 0 && x < 8 && y >= 0 && y < 8) {
-                struct chess_piece p = board->board_array[y][x];
-                if (p.piece_type == PIECE_KNIGHT && p.colour == board->next_move_player) {
-                    if (found == 0) {
-                        src_x = x;
-                        src_y = y;
-                    }
-                    found++;
-                }
-            }
-        }
+    if (size > 0) {
+        size_t copied = n < size ? n : size - 1;
+        memcpy(buffer, fen, copied);
+        buffer[copied] = '\0';
+    }
+    return n;
+}
+
+// records why a move could not be completed
+static enum chess_status completion_error(struct chess_error *error, enum chess_status status, const char *reason) {
+    error->status = status;
+    error->reason = reason;
+    return status;
+}
+
+// Checks whether the square would be attacked by the attacker's pieces with the given occupancy, ignoring any
+// of the attacker's pieces on the squares in removed. Used to test a position after a move without making it.
+static bool attacked_with(const struct chess_board *board, int square, enum chess_player attacker,
+                          bitboard occupied, bitboard removed) {
+    const enum chess_player defender = (attacker == PLAYER_WHITE) ? PLAYER_BLACK : PLAYER_WHITE;
+    const bitboard pieces = board->colour_bitboards[attacker] & ~removed;
+    const bitboard queens = board->piece_bitboards[PIECE_QUEEN];
+
+    // each test looks from the square outward as the attacking piece type would, and intersects with the
+    // attacker's pieces of that type
+    return ((pawn_attacks(square, defender) & board->piece_bitboards[PIECE_PAWN]) |
+            (knight_attacks(square) & board->piece_bitboards[PIECE_KNIGHT]) |
+            (king_attacks(square) & board->piece_bitboards[PIECE_KING]) |
+            (bishop_attacks(square, occupied) & (board->piece_bitboards[PIECE_BISHOP] | queens)) |
+            (rook_attacks(square, occupied) & (board->piece_bitboards[PIECE_ROOK] | queens))) & pieces;
+}
+
+// Checks whether the player to move would leave their own king attacked by moving the piece on source to target.
+// captured is the square of the piece taken, which differs from the target for en passant.
+static bool leaves_king_attacked(const struct chess_board *board, int source, int target, int captured) {
+    const enum chess_player player = board->next_move_player;
+    const enum chess_player enemy = (player == PLAYER_WHITE) ? PLAYER_BLACK : PLAYER_WHITE;
+    const int king = board_king_square(board, player);
+    const bitboard occupied = ((board_occupied(board) & ~SQUARE_BIT(source)) & ~SQUARE_BIT(captured)) |
+                              SQUARE_BIT(target);
+
+    return attacked_with(board, source == king ? target : king, enemy, occupied, SQUARE_BIT(captured));
+}
 
-        if (found == 0) {
-            panicf("move completion error: %s knight to %c%d (no knight can move)",
-                   player_string(board->next_move_player),
-                   'a' + move->target_square_x,
-                   move->target_square_y + 1);
-        } else if (found > 1) {
-            // Use disambiguation if provided
-            if (move->source_x != -1 || move->source_y != -1) {
-                bool matched = false;
-                for (int i = 0; i < 8; i++) {
-                    int x = move->target_square_x + offsets[i][0];
-                    int y = move->target_square_y + offsets[i][1];
-                    if (x >= 0 && x < 8 && y >= 0 && y < 8) {
-                        struct chess_piece p = board->board_array[y][x];
-                        if (p.piece_type == PIECE_KNIGHT && p.colour == board->next_move_player) {
-                            if ((move->source_x == -1 || move->source_x == x) &&
-                                (move->source_y == -1 || move->source_y == y)) {
-                                src_x = x;
-                                src_y = y;
-                                matched = true;
-                            }
-                        }
-                    }
-                }
-                if (!matched) {
-                    panicf("move completion error: %s knight to %c%d (disambiguation does not match any knight)",
-                           player_string(board->next_move_player),
-                           'a' + move->target_square_x,
-                           move->target_square_y + 1);
-                }
+// Completes a castling move after checking that the right to castle on that side is still held, that the squares
+// between the king and rook are empty, and that the king does not start on, cross or land on an attacked square.
+static enum chess_status complete_castling(const struct chess_board *board, struct chess_move *move,
+                                           struct chess_error *error) {
+    const enum chess_player player = board->next_move_player;
+    const enum chess_player enemy = (player == PLAYER_WHITE) ? PLAYER_BLACK : PLAYER_WHITE;
+    const int y = (player == PLAYER_WHITE ? 0 : 7);
+    const bool kingside = move->castling == CASTLE_KINGSIDE;
+    const uint8_t right = kingside ? (player == PLAYER_WHITE ? CASTLING_WHITE_KINGSIDE : CASTLING_BLACK_KINGSIDE)
+                                   : (player == PLAYER_WHITE ? CASTLING_WHITE_QUEENSIDE : CASTLING_BLACK_QUEENSIDE);
+
+    // squares between king and rook: f,g for kingside and b,c,d for queenside
+    const bitboard between = kingside ? 0x60ULL << (y * 8) : 0x0EULL << (y * 8);
+    const int rook_square = SQUARE(kingside ? 7 : 0, y);
+
+    if (!(board_pieces(board, player, PIECE_ROOK) & SQUARE_BIT(rook_square))) {
+        return completion_error(error, CHESS_ERROR_NO_PIECE, "castling rook not present");
+    }
+    if (board_occupied(board) & between) {
+        return completion_error(error, CHESS_ERROR_ILLEGAL, "castling path blocked");
+    }
+    if (!(board_pieces(board, player, PIECE_KING) & SQUARE_BIT(SQUARE(4, y)))) {
+        return completion_error(error, CHESS_ERROR_NO_PIECE, "king not on starting square");
+    }
+    if (!(board->castling_rights & right)) {
+        return completion_error(error, CHESS_ERROR_ILLEGAL, "king or rook has already moved");
+    }
+
+    // the king passes over the square next to it and lands on the one after
+    const int step = kingside ? 1 : -1;
+    if (is_square_attacked(board, SQUARE(4, y), enemy) ||
+        is_square_attacked(board, SQUARE(4 + step, y), enemy) ||
+        is_square_attacked(board, SQUARE(4 + 2 * step, y), enemy)) {
+        return completion_error(error, CHESS_ERROR_ILLEGAL, "castling out of, through or into check");
+    }
+
+    move->source_x = 4;
+    move->source_y = y;
+    move->target_square_x = kingside ? 6 : 2;
+    move->target_square_y = y;
+    move->en_passant = false;
+    move->moving_piece = board_piece_at(board, SQUARE(4, y));
+    return CHESS_OK;
+}
+
+// Finds the squares holding pawns that can make the given pawn move.
+static enum chess_status pawn_sources(const struct chess_board *board, struct chess_move *move,
+                                      bitboard *sources, struct chess_error *error) {
+    const enum chess_player player = board->next_move_player;
+    const int target = SQUARE(move->target_square_x, move->target_square_y);
+    const bitboard pawns = board_pieces(board, player, PIECE_PAWN);
+
+    move->en_passant = false;
+    *sources = 0;
+
+    // a pawn promotes exactly when it reaches the last rank
+    const int last_rank = (player == PLAYER_WHITE) ? 7 : 0;
+    if (move->promotion != (move->target_square_y == last_rank)) {
+        return completion_error(error, CHESS_ERROR_ILLEGAL,
+                                move->promotion ? "promotion before the last rank" : "pawn must promote");
+    }
+
+    if (move->capture) {
+        // error if there isn't a piece to capture, unless it is an en passant capture
+        if (!(board_occupied(board) & SQUARE_BIT(target))) {
+            if (board->en_passant_square == target) {
+                move->en_passant = true;
             } else {
-                panicf("move completion error: %s knight to %c%d (ambiguous knight move, source not specified)",
-                       player_string(board->next_move_player),
-                       'a' + move->target_square_x,
-                       move->target_square_y + 1);
+                return completion_error(error, CHESS_ERROR_ILLEGAL, "capture on empty square");
             }
         }
 
-        // Finalize
-        move->source_x = src_x;
-        move->source_y = src_y;
-        move->moving_piece = board->board_array[src_y][src_x];
+        // a pawn captures onto the target from the squares an enemy pawn on the target would attack
+        *sources = pawn_attacks(target, player == PLAYER_WHITE ? PLAYER_BLACK : PLAYER_WHITE) & pawns;
+        return CHESS_OK;
     }
-    else if (move->piece_type == PIECE_KING && move->castling != CASTLE_NONE) {
-    int src_x = 4; // e-file
-    int src_y = (board->next_move_player == PLAYER_WHITE ? 0 : 7);
 
-    int dst_x, dst_y;
-    dst_y = src_y;
+    if (board_occupied(board) & SQUARE_BIT(target)) {
+        return completion_error(error, CHESS_ERROR_ILLEGAL, "target square occupied");
+    }
 
-    if (move->castling == CASTLE_KINGSIDE) {
-        dst_x = 6; // g-file
-        // Check rook presence
-        struct chess_piece rook = board->board_array[src_y][7];
-        if (rook.piece_type != PIECE_ROOK || rook.colour != board->next_move_player) {
-            panicf("move completion error: %s castling kingside (rook not present)",
-                   player_string(board->next_move_player));
-        }
-        // Check empty squares between king and rook
-        if (board->board_array[src_y][5].piece_type != PIECE_EMPTY ||
-            board->board_array[src_y][6].piece_type != PIECE_EMPTY) {
-            panicf("move completion error: %s castling kingside (path blocked)",
-                   player_string(board->next_move_player));
-        }
-    } else { // Queenside
-        dst_x = 2; // c-file
-        struct chess_piece rook = board->board_array[src_y][0];
-        if (rook.piece_type != PIECE_ROOK || rook.colour != board->next_move_player) {
-            panicf("move completion error: %s castling queenside (rook not present)",
-                   player_string(board->next_move_player));
-        }
-        if (board->board_array[src_y][1].piece_type != PIECE_EMPTY ||
-            board->board_array[src_y][2].piece_type != PIECE_EMPTY ||
-            board->board_array[src_y][3].piece_type != PIECE_EMPTY) {
-            panicf("move completion error: %s castling queenside (path blocked)",
-                   player_string(board->next_move_player));
-        }
+    // pawns move up the board for white and down for black
+    const int back = (player == PLAYER_WHITE) ? -8 : 8;
+    const int double_push_rank = (player == PLAYER_WHITE) ? 3 : 4;
+    const int behind = target + back;
+    if (behind < 0 || behind >= 64) {
+        return CHESS_OK;
+    }
+    if (pawns & SQUARE_BIT(behind)) {
+        *sources = SQUARE_BIT(behind);
     }
 
-    // Confirm king is on starting square
-    struct chess_piece king = board->board_array[src_y][src_x];
-    if (king.piece_type != PIECE_KING || king.colour != board->next_move_player) {
-        panicf("move completion error: %s castling (king not on starting square)",
-               player_string(board->next_move_player));
-    }
-
-    // TODO: add checks for "king/rook has not moved" and "squares not attacked"
-    // These require extra state tracking and an attack-detection helper.
-
-    // Finalize move
-    move->source_x = src_x;
-    move->source_y = src_y;
-    move->target_square_x = dst_x;
-    move->target_square_y = dst_y;
-    move->moving_piece = king;
-}
-
-    else if (move->piece_type == PIECE_KING) {
-        int src_x = -1, src_y = -1;
-        int found = 0;
-
-        // All 8 king move offsets
-        int offsets[8][2] = {
-            {1,0}, {-1,0}, {0,1}, {0,-1},
-            {1,1}, {1,-1}, {-1,1}, {-1,-1}
-        };
-
-        // Instead of target+offset, check target-offset
-        for (int i = 0; i < 8; i++) {
-            int x = move->target_square_x - offsets[i][0];
-            int y = move->target_square_y - offsets[i][1];
-            if (x >= 0 && x < 8 && y >= 0 && y < 8) {
-                struct chess_piece p = board->board_array[y][x];
-                if (p.piece_type == PIECE_KING && p.colour == board->next_move_player) {
-                    src_x = x; src_y = y;
-                    found++;
-                }
-            }
-        }
+    //checks case that pawn moves 2 squares from it's starting position
+    else if (move->target_square_y == double_push_rank && !(board_occupied(board) & SQUARE_BIT(behind))) {
+        *sources = pawns & SQUARE_BIT(behind + back);
+    }
+    return CHESS_OK;
+}
 
-        if (found == 0) {
-            panicf("move completion error: %s king to %c%d (no king can move)",
-                   player_string(board->next_move_player),
-                   'a' + move->target_square_x,
-                   move->target_square_y + 1);
-        } else if (found > 1) {
-            // Should never happen — each side has only one king
-            panicf("move completion error: %s king to %c%d (ambiguous king move)",
-                   player_string(board->next_move_player),
-                   'a' + move->target_square_x,
-                   move->target_square_y + 1);
-        }
+// fills out necessary fields of the given move struct so the apply move function will know exactly which piece is
+//moving and if it is actually legal
+enum chess_status board_try_complete_move(const struct chess_board *board, struct chess_move *move,
+                                          struct chess_error *error) {
+    const enum chess_player player = board->next_move_player;
+    const int target = SQUARE(move->target_square_x, move->target_square_y);
+    const bitboard occupied = board_occupied(board);
 
-        // Finalize
-        move->source_x = src_x;
-        move->source_y = src_y;
-        move->moving_piece = board->board_array[src_y][src_x];
+    if (move->piece_type == PIECE_KING && move->castling != CASTLE_NONE) {
+        return complete_castling(board, move, error);
     }
 
-else if (move->piece_type == PIECE_KING && move->castling != CASTLE_NONE) {
-    int src_x = 4; // e-file
-    int src_y = (board->next_move_player == PLAYER_WHITE ? 0 : 7);
+    // Error if target square contains a piece of the same colour
+    if (board->colour_bitboards[player] & SQUARE_BIT(target)) {
+        return completion_error(error, CHESS_ERROR_ILLEGAL, "same colour on target");
+    }
 
-    int dst_x, dst_y;
-    dst_y = src_y;
+    // the king is never actually taken, which keeps king_squares valid even for games with illegal moves
+    if (board->piece_bitboards[PIECE_KING] & SQUARE_BIT(target)) {
+        return completion_error(error, CHESS_ERROR_ILLEGAL, "king cannot be captured");
+    }
 
-    if (move->castling == CASTLE_KINGSIDE) {
-        dst_x = 6; // g-file
-        // Check rook presence
-        struct chess_piece rook = board->board_array[src_y][7];
-        if (rook.piece_type != PIECE_ROOK || rook.colour != board->next_move_player) {
-            panicf("move completion error: %s castling kingside (rook not present)",
-                   player_string(board->next_move_player));
-        }
-        // Check empty squares between king and rook
-        if (board->board_array[src_y][5].piece_type != PIECE_EMPTY ||
-            board->board_array[src_y][6].piece_type != PIECE_EMPTY) {
-            panicf("move completion error: %s castling kingside (path blocked)",
-                   player_string(board->next_move_player));
-        }
-    } else { // Queenside
-        dst_x = 2; // c-file
-        struct chess_piece rook = board->board_array[src_y][0];
-        if (rook.piece_type != PIECE_ROOK || rook.colour != board->next_move_player) {
-            panicf("move completion error: %s castling queenside (rook not present)",
-                   player_string(board->next_move_player));
-        }
-        if (board->board_array[src_y][1].piece_type != PIECE_EMPTY ||
-            board->board_array[src_y][2].piece_type != PIECE_EMPTY ||
-            board->board_array[src_y][3].piece_type != PIECE_EMPTY) {
-            panicf("move completion error: %s castling queenside (path blocked)",
-                   player_string(board->next_move_player));
-        }
+    // Every piece that could reach the target square. For the pieces other than pawns this is the set of squares
+    // the same piece would attack from the target square.
+    bitboard candidates = 0;
+    enum chess_status status = CHESS_OK;
+    switch (move->piece_type) {
+        case PIECE_PAWN:
+            status = pawn_sources(board, move, &candidates, error);
+            break;
+        case PIECE_KNIGHT:
+            candidates = knight_attacks(target);
+            break;
+        case PIECE_BISHOP:
+            candidates = bishop_attacks(target, occupied);
+            break;
+        case PIECE_ROOK:
+            candidates = rook_attacks(target, occupied);
+            break;
+        case PIECE_QUEEN:
+            candidates = queen_attacks(target, occupied);
+            break;
+        case PIECE_KING:
+            candidates = king_attacks(target);
+            break;
+        default:
+            break;
+    }
+    if (status != CHESS_OK) {
+        return status;
     }
+    if (move->piece_type != PIECE_PAWN) {
+        // an x in the notation is optional for pieces, so whether the move captures is read from the board; the
+        // completed move is then the same however it was written
+        move->en_passant = false;
+        move->capture = (occupied & SQUARE_BIT(target)) != 0;
+    }
+    candidates &= board_pieces(board, player, move->piece_type);
 
-    // Confirm king is on starting square
-    struct chess_piece king = board->board_array[src_y][src_x];
-    if (king.piece_type != PIECE_KING || king.colour != board->next_move_player) {
-        panicf("move completion error: %s castling (king not on starting square)",
-               player_string(board->next_move_player));
+    if (candidates == 0) {
+        return completion_error(error, CHESS_ERROR_NO_PIECE, "no piece can move");
     }
 
-    // TODO: add checks for "king/rook has not moved" and "squares not attacked"
-    // These require extra state tracking and an attack-detection helper.
+    // Use disambiguation if provided
+    bitboard matching = candidates;
+    if (move->source_x != -1) {
+        matching &= FILE_MASK(move->source_x);
+    }
+    if (move->source_y != -1) {
+        matching &= RANK_MASK(move->source_y);
+    }
 
-    // Finalize move
-    move->source_x = src_x;
-    move->source_y = src_y;
-    move->target_square_x = dst_x;
-    move->target_square_y = dst_y;
-    move->moving_piece = king;
-}
+    if (matching == 0) {
+        return completion_error(error, CHESS_ERROR_NO_PIECE, "disambiguation does not match any piece");
+    }
 
+    // drop the pieces that are pinned to their king or that leave it in check
+    const int captured = move->en_passant ? target + (player == PLAYER_WHITE ? -8 : 8) : target;
+    bitboard legal = 0;
+    for (bitboard rest = matching; rest;) {
+        const int source = bitboard_pop_lsb(&rest);
+        if (!leaves_king_attacked(board, source, target, captured)) {
+            legal |= SQUARE_BIT(source);
+        }
+    }
+    matching = legal;
 
+    if (matching == 0) {
+        return completion_error(error, CHESS_ERROR_ILLEGAL, "move leaves the king in check");
+    } else if (bitboard_several(matching)) {
+        return completion_error(error, CHESS_ERROR_AMBIGUOUS, "ambiguous move, source not specified");
+    }
 
+    // Finalize
+    const int source = bitboard_lsb(matching);
+    move->source_x = SQUARE_FILE(source);
+    move->source_y = SQUARE_RANK(source);
+    move->moving_piece = board_piece_at(board, source);
+    return CHESS_OK;
+}
+
+void board_complete_move(const struct chess_board *board, struct chess_move *move) {
+    struct chess_error error;
+    if (board_try_complete_move(board, move, &error) != CHESS_OK) {
+        panicf("move completion error: %s %s to %c%d (%s)\n",
+               player_string(board->next_move_player),
+               piece_string(move->piece_type),
+               'a' + move->target_square_x,
+               move->target_square_y + 1,
+               error.reason);
+    }
 }
 
 
 // Helper: convert piece to char
-char piece_char(struct chess_piece p) {
-    if (p.piece_type == PIECE_EMPTY) return '.';
+char piece_char(piece_code p) {
+    if (p == PIECE_CODE_EMPTY) return '.';
 
     char c;
-    switch (p.piece_type) {
+    switch (PIECE_CODE_TYPE(p)) {
         case PIECE_PAWN: c = 'P';
             break;
         case PIECE_KNIGHT: c = 'N';
@@ -825,66 +645,250 @@ char piece_char(struct chess_piece p) {
     return c;
 }
 
-// Draw the board
-void board_draw(const struct chess_board *board) {
-    printf("\n   a b c d e f g h\n");
-    printf("  -----------------\n");
+// Renders the board as text, ranks 8 down to 1
+void board_render(const struct chess_board *board, struct output_buffer *out) {
+    static const char files[] = "   a b c d e f g h\n";
+    static const char rule[] = "  -----------------\n";
+
+    // the whole board is laid out in one fixed-size block and appended with a single copy
+    char text[1 + 2 * sizeof(files) + 2 * sizeof(rule) + 8 * 22 + 1];
+    size_t n = 0;
+
+    text[n++] = '\n';
+    memcpy(text + n, files, sizeof(files) - 1);
+    n += sizeof(files) - 1;
+    memcpy(text + n, rule, sizeof(rule) - 1);
+    n += sizeof(rule) - 1;
 
     for (int y = 7; y >= 0; y--) {
-        // rank 8 down to 1
-        printf("%d| ", y + 1);
+        // each rank reads e.g. "8| R N B Q K B N R |8"
+        text[n++] = (char) ('1' + y);
+        text[n++] = '|';
+        text[n++] = ' ';
         for (int x = 0; x < 8; x++) {
-            printf("%c ", piece_char(board->board_array[y][x]));
+            text[n++] = piece_char(board_piece_at(board, SQUARE(x, y)));
+            text[n++] = ' ';
         }
-        printf("|%d\n", y + 1);
+        text[n++] = '|';
+        text[n++] = (char) ('1' + y);
+        text[n++] = '\n';
     }
 
-    printf("  -----------------\n");
-    printf("   a b c d e f g h\n\n");
+    memcpy(text + n, rule, sizeof(rule) - 1);
+    n += sizeof(rule) - 1;
+    memcpy(text + n, files, sizeof(files) - 1);
+    n += sizeof(files) - 1;
+    text[n++] = '\n';
+
+    output_append(out, text, n);
 }
 
-void board_apply_move(struct chess_board *board, const struct chess_move *move) {
-    //if a piece is captured, the target square needs to be reset to empty
-    if (move->capture) {
-        board->board_array[move->target_square_y][move->target_square_x] = empty_piece;
+// Draw the board
+void board_draw(const struct chess_board *board) {
+    struct output_buffer out;
+    output_init(&out);
+    board_render(board, &out);
+    output_flush(&out, stdout);
+    output_free(&out);
+}
+
+// Castling rights kept after a move from or to each square: moving the king or a rook, or capturing a rook on its
+// starting square, loses the corresponding rights.
+static uint8_t castling_rights_mask(int square) {
+    switch (square) {
+        case SQUARE(0, 0): return (uint8_t) ~CASTLING_WHITE_QUEENSIDE;
+        case SQUARE(4, 0): return (uint8_t) ~(CASTLING_WHITE_KINGSIDE | CASTLING_WHITE_QUEENSIDE);
+        case SQUARE(7, 0): return (uint8_t) ~CASTLING_WHITE_KINGSIDE;
+        case SQUARE(0, 7): return (uint8_t) ~CASTLING_BLACK_QUEENSIDE;
+        case SQUARE(4, 7): return (uint8_t) ~(CASTLING_BLACK_KINGSIDE | CASTLING_BLACK_QUEENSIDE);
+        case SQUARE(7, 7): return (uint8_t) ~CASTLING_BLACK_KINGSIDE;
+        default: return 0xFF;
+    }
+}
+
+packed_move move_pack(const struct chess_move *move) {
+    const int source = SQUARE(move->source_x, move->source_y);
+    const int target = SQUARE(move->target_square_x, move->target_square_y);
+    int flags = MOVE_QUIET;
+
+    if (move->castling == CASTLE_KINGSIDE) {
+        flags = MOVE_KINGSIDE_CASTLE;
+    } else if (move->castling == CASTLE_QUEENSIDE) {
+        flags = MOVE_QUEENSIDE_CASTLE;
+    } else if (move->en_passant) {
+        flags = MOVE_EN_PASSANT;
+    } else {
+        if (move->promotion) {
+            flags = MOVE_PROMOTION_TO(move->promotion_piece);
+        } else if (move->piece_type == PIECE_PAWN && abs(move->target_square_y - move->source_y) == 2) {
+            flags = MOVE_DOUBLE_PUSH;
+        }
+        if (move->capture) {
+            flags |= MOVE_CAPTURE;
+        }
+    }
+    return PACK_MOVE(source, target, flags);
+}
+
+void move_unpack(const struct chess_board *board, packed_move packed, struct chess_move *move) {
+    const int source = PACKED_FROM(packed);
+    const int target = PACKED_TO(packed);
+    const int flags = PACKED_FLAGS(packed);
+
+    move->moving_piece = board_piece_at(board, source);
+    move->piece_type = PIECE_CODE_TYPE(move->moving_piece);
+
+    move->source_x = SQUARE_FILE(source);
+    move->source_y = SQUARE_RANK(source);
+
+    move->target_square_x = SQUARE_FILE(target);
+    move->target_square_y = SQUARE_RANK(target);
+
+    move->en_passant = flags == MOVE_EN_PASSANT;
+    move->capture = (flags & MOVE_CAPTURE) != 0;
+    move->promotion = (flags & MOVE_PROMOTION) != 0;
+    move->promotion_piece = move->promotion ? (enum piece_type) (PIECE_KNIGHT + (flags & 3)) : PIECE_EMPTY;
+    move->castling = flags == MOVE_KINGSIDE_CASTLE ? CASTLE_KINGSIDE :
+                     flags == MOVE_QUEENSIDE_CASTLE ? CASTLE_QUEENSIDE : CASTLE_NONE;
+}
+
+void move_to_coordinates(packed_move packed, char out[6]) {
+    const int source = PACKED_FROM(packed);
+    const int target = PACKED_TO(packed);
+    out[0] = (char) ('a' + SQUARE_FILE(source));
+    out[1] = (char) ('1' + SQUARE_RANK(source));
+    out[2] = (char) ('a' + SQUARE_FILE(target));
+    out[3] = (char) ('1' + SQUARE_RANK(target));
+    out[4] = (PACKED_FLAGS(packed) & MOVE_PROMOTION) ? "nbrq"[PACKED_FLAGS(packed) & 3] : '\0';
+    out[5] = '\0';
+}
+
+bool move_fits_board(const struct chess_board *board, packed_move packed) {
+    const int source = PACKED_FROM(packed);
+    const int target = PACKED_TO(packed);
+    const int flags = PACKED_FLAGS(packed);
+    const enum chess_player mover = board->next_move_player;
+    const enum chess_player enemy = mover == PLAYER_WHITE ? PLAYER_BLACK : PLAYER_WHITE;
+    const piece_code moving = board_piece_at(board, source);
+    const piece_code taken = board_piece_at(board, target);
+    const enum piece_type type = PIECE_CODE_TYPE(moving);
+    const int home = mover == PLAYER_WHITE ? 0 : 7;
+
+    if (moving == PIECE_CODE_EMPTY || PIECE_CODE_COLOUR(moving) != mover || source == target) {
+        return false;
+    }
+
+    // a castle moves the king and rook from their home squares whatever else the move says, so both must be there
+    // with nothing between them
+    if (flags == MOVE_KINGSIDE_CASTLE || flags == MOVE_QUEENSIDE_CASTLE) {
+        const bool kingside = flags == MOVE_KINGSIDE_CASTLE;
+        const int right = (kingside ? CASTLING_WHITE_KINGSIDE : CASTLING_WHITE_QUEENSIDE) << (2 * mover);
+        if (type != PIECE_KING || source != SQUARE(4, home) || target != SQUARE(kingside ? 6 : 2, home) ||
+            !(board->castling_rights & right) ||
+            board_piece_at(board, SQUARE(kingside ? 7 : 0, home)) != PIECE_CODE(mover, PIECE_ROOK)) {
+            return false;
+        }
+        for (int x = kingside ? 5 : 1; x <= (kingside ? 6 : 3); x++) {
+            if (board_piece_at(board, SQUARE(x, home)) != PIECE_CODE_EMPTY) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (flags == MOVE_EN_PASSANT) {
+        return type == PIECE_PAWN && target == board->en_passant_square &&
+               board_piece_at(board, SQUARE(SQUARE_FILE(target), SQUARE_RANK(source))) == PIECE_CODE(enemy, PIECE_PAWN);
     }
+    if (flags == (MOVE_CAPTURE | MOVE_KINGSIDE_CASTLE) || flags == (MOVE_CAPTURE | MOVE_QUEENSIDE_CASTLE)) {
+        return false; // no move has these flags
+    }
+
+    // kings are never taken, and the capture flag must agree with the target square
+    if ((taken != PIECE_CODE_EMPTY) != ((flags & MOVE_CAPTURE) != 0) ||
+        (taken != PIECE_CODE_EMPTY && (PIECE_CODE_COLOUR(taken) == mover || PIECE_CODE_TYPE(taken) == PIECE_KING))) {
+        return false;
+    }
+
+    // a pawn promotes exactly when it reaches the last rank
+    const bool last_rank = SQUARE_RANK(target) == 7 - home;
+    if (flags & MOVE_PROMOTION) {
+        return type == PIECE_PAWN && last_rank;
+    }
+    return type != PIECE_PAWN || !last_rank;
+}
+
+void board_make_move(struct chess_board *board, const struct chess_move *move, struct board_undo *undo) {
+    const int source = SQUARE(move->source_x, move->source_y);
+    const int target = SQUARE(move->target_square_x, move->target_square_y);
+
+    undo->hash = board->hash;
+    undo->captured = PIECE_CODE_EMPTY;
+    undo->castling_rights = board->castling_rights;
+    undo->en_passant_square = board->en_passant_square;
+    undo->halfmove_clock = board->halfmove_clock;
+    board->history[board->ply++ % BOARD_HISTORY_SIZE] = board->hash;
+
+    // the pieces update the hash as they move; the rest of the state is taken out here and put back at the end
+    board->hash ^= zobrist_castling[board->castling_rights] ^ zobrist_black_to_move;
+    if (board->en_passant_square != NO_SQUARE) {
+        board->hash ^= zobrist_en_passant[SQUARE_FILE(board->en_passant_square)];
+    }
+
     // Apply castling move: rearrange pieces only
     if (move->piece_type == PIECE_KING && move->castling != CASTLE_NONE) {
-        int y = (move->moving_piece.colour == PLAYER_WHITE ? 0 : 7);
+        int y = (PIECE_CODE_COLOUR(move->moving_piece) == PLAYER_WHITE ? 0 : 7);
 
         if (move->castling == CASTLE_KINGSIDE) {
-            // King: e -> g
-            board->board_array[y][6] = board->board_array[y][4];
-            board->board_array[y][4].piece_type = PIECE_EMPTY;
-
-            // Rook: h -> f
-            board->board_array[y][5] = board->board_array[y][7];
-            board->board_array[y][7].piece_type = PIECE_EMPTY;
-        } else { // Queenside
-            // King: e -> c
-            board->board_array[y][2] = board->board_array[y][4];
-            board->board_array[y][4].piece_type = PIECE_EMPTY;
-
-            // Rook: a -> d
-            board->board_array[y][3] = board->board_array[y][0];
-            board->board_array[y][0].piece_type = PIECE_EMPTY;
+            board_move_piece(board, SQUARE(4, y), SQUARE(6, y)); // King: e -> g
+            board_move_piece(board, SQUARE(7, y), SQUARE(5, y)); // Rook: h -> f
+        } else {
+            board_move_piece(board, SQUARE(4, y), SQUARE(2, y)); // King: e -> c
+            board_move_piece(board, SQUARE(0, y), SQUARE(3, y)); // Rook: a -> d
+        }
+    } else {
+        //if a piece is captured, the target square needs to be reset to empty. An en passant capture removes the
+        //pawn standing beside the source square instead.
+        if (move->en_passant) {
+            undo->captured = board_remove_piece(board, SQUARE(move->target_square_x, move->source_y));
+        } else {
+            undo->captured = board_remove_piece(board, target);
+        }
+        //move piece to another square while replacing the source square with an empty space
+        board_move_piece(board, source, target);
+
+        if (move->promotion) {
+            board_remove_piece(board, target);
+            board_put_piece(board, target, PIECE_CODE(PIECE_CODE_COLOUR(move->moving_piece), move->promotion_piece));
         }
     }
+    board->castling_rights &= castling_rights_mask(source) & castling_rights_mask(target);
 
+    // The square is only recorded when an enemy pawn stands ready to capture, so that positions which differ only
+    // by an unusable en passant square count as the same for repetitions.
+    const int skipped = (source + target) / 2;
+    const enum chess_player mover = PIECE_CODE_COLOUR(move->moving_piece);
+    const enum chess_player enemy = mover == PLAYER_WHITE ? PLAYER_BLACK : PLAYER_WHITE;
     if (move->piece_type == PIECE_PAWN &&
-        abs(move->target_square_y - move->source_y) == 2)
+        abs(move->target_square_y - move->source_y) == 2 &&
+        (pawn_attacks(skipped, mover) & board_pieces(board, enemy, PIECE_PAWN)))
     {
-        board->en_passant_available = 1;
-        board->en_passant_x = move->source_x;
-        board->en_passant_y =
-            (move->source_y + move->target_square_y) / 2;
+        board->en_passant_square = (int8_t) skipped;
     }
     else {
-        board->en_passant_available = 0;
+        board->en_passant_square = NO_SQUARE;
+    }
+    board->hash ^= zobrist_castling[board->castling_rights];
+    if (board->en_passant_square != NO_SQUARE) {
+        board->hash ^= zobrist_en_passant[SQUARE_FILE(board->en_passant_square)];
+    }
+
+    // captures and pawn moves cannot be undone, so they restart the count towards the fifty-move rule
+    if (move->piece_type == PIECE_PAWN || undo->captured != PIECE_CODE_EMPTY) {
+        board->halfmove_clock = 0;
+    } else {
+        board->halfmove_clock++;
     }
-    //move piece to another square while replacing the source square with an empty space
-    board->board_array[move->target_square_y][move->target_square_x] = move->moving_piece;
-    board->board_array[move->source_y][move->source_x] = empty_piece;
 
     // The final step is to update the turn of players in the board state.
     switch (board->next_move_player) {
@@ -893,130 +897,160 @@ void board_apply_move(struct chess_board *board, const struct chess_move *move)
             break;
         case PLAYER_BLACK:
             board->next_move_player = PLAYER_WHITE;
+            board->fullmove_number++;
             break;
     }
-    board_draw(board);
 }
 
-// TODO: print the state of the game.
-//helper: check if coordinates are valid
-bool is_valid_pos(int x, int y) {
-    return x >= 0 && x < 8 && y >= 0 && y < 8;
-}
+void board_unmake_move(struct chess_board *board, const struct chess_move *move, const struct board_undo *undo) {
+    const int source = SQUARE(move->source_x, move->source_y);
+    const int target = SQUARE(move->target_square_x, move->target_square_y);
+    const enum chess_player player = board->next_move_player == PLAYER_WHITE ? PLAYER_BLACK : PLAYER_WHITE;
 
-//core logic: check if the current player's king is under attack
-bool is_in_check(const struct chess_board *board, enum chess_player player) {
-    int kx = -1, ky = -1;
+    // the same steps as board_make_move in reverse
+    if (move->piece_type == PIECE_KING && move->castling != CASTLE_NONE) {
+        int y = (player == PLAYER_WHITE ? 0 : 7);
 
-    //1.find the king
-    for (int y = 0; y < 8; y++) {
-        for (int x = 0; x < 8; x++) {
-            if (board->board_array[y][x].piece_type == PIECE_KING &&
-                board->board_array[y][x].colour == player) {
-                kx = x;
-                ky = y;
-                break;
-            }
+        if (move->castling == CASTLE_KINGSIDE) {
+            board_move_piece(board, SQUARE(6, y), SQUARE(4, y));
+            board_move_piece(board, SQUARE(5, y), SQUARE(7, y));
+        } else {
+            board_move_piece(board, SQUARE(2, y), SQUARE(4, y));
+            board_move_piece(board, SQUARE(3, y), SQUARE(0, y));
+        }
+    } else {
+        if (move->promotion) {
+            board_remove_piece(board, target);
+            board_put_piece(board, target, PIECE_CODE(player, PIECE_PAWN));
+        }
+        board_move_piece(board, target, source);
+
+        if (undo->captured != PIECE_CODE_EMPTY) {
+            int captured_square = move->en_passant ? SQUARE(move->target_square_x, move->source_y) : target;
+            board_put_piece(board, captured_square, undo->captured);
         }
-        if (kx != -1) break;
     }
 
-    if (kx == -1) return false;
+    board->next_move_player = player;
+    if (player == PLAYER_BLACK) {
+        board->fullmove_number--;
+    }
+    board->castling_rights = undo->castling_rights;
+    board->en_passant_square = undo->en_passant_square;
+    board->halfmove_clock = undo->halfmove_clock;
+    board->hash = undo->hash;
+    board->ply--;
+}
+
+void board_apply_move(struct chess_board *board, const struct chess_move *move) {
+    struct board_undo undo;
+    board_make_move(board, move, &undo);
+}
 
+//checks if any piece of the given player attacks the square
+bool is_square_attacked(const struct chess_board *board, int square, enum chess_player attacker) {
+    return attacked_with(board, square, attacker, board_occupied(board), 0);
+}
+
+//core logic: check if the current player's king is under attack
+bool is_in_check(const struct chess_board *board, enum chess_player player) {
     enum chess_player enemy = (player == PLAYER_WHITE) ? PLAYER_BLACK : PLAYER_WHITE;
+    return is_square_attacked(board, board_king_square(board, player), enemy);
+}
 
-    //2.check straight lines (rook/queen)
-    int dirs_straight[4][2] = {{0, 1}, {0, -1}, {1, 0}, {-1, 0}};
-    for (int i = 0; i < 4; i++) {
-        for (int dist = 1; dist < 8; dist++) {
-            int nx = kx + dirs_straight[i][0] * dist;
-            int ny = ky + dirs_straight[i][1] * dist;
-            
-            if (!is_valid_pos(nx, ny)) break;
-
-            struct chess_piece p = board->board_array[ny][nx];
-            if (p.piece_type == PIECE_EMPTY) continue;
-            
-            if (p.colour == player) break; //blocked by own piece
-            if (p.colour == enemy) {
-                if (p.piece_type == PIECE_ROOK || p.piece_type == PIECE_QUEEN) return true;
-                break; //blocked by non-attacking enemy
-            }
-        }
+//helper:check if the player to move has any legal moves
+bool has_legal_moves(const struct chess_board *board) {
+    struct chess_move_list moves;
+    return board_generate_moves(board, &moves) > 0;
+}
+
+bool board_insufficient_material(const struct chess_board *board) {
+    const uint8_t *white = board->piece_counts[PLAYER_WHITE];
+    const uint8_t *black = board->piece_counts[PLAYER_BLACK];
+
+    // a pawn can still promote and a rook or queen can mate on its own
+    if (white[PIECE_PAWN] | white[PIECE_ROOK] | white[PIECE_QUEEN] |
+        black[PIECE_PAWN] | black[PIECE_ROOK] | black[PIECE_QUEEN]) {
+        return false;
     }
 
-    //3.check diagonals (bishop/queen)
-    int dirs_diag[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
-    for (int i = 0; i < 4; i++) {
-        for (int dist = 1; dist < 8; dist++) {
-            int nx = kx + dirs_diag[i][0] * dist;
-            int ny = ky + dirs_diag[i][1] * dist;
-            
-            if (!is_valid_pos(nx, ny)) break;
-
-            struct chess_piece p = board->board_array[ny][nx];
-            if (p.piece_type == PIECE_EMPTY) continue;
-            
-            if (p.colour == player) break;
-            if (p.colour == enemy) {
-                if (p.piece_type == PIECE_BISHOP || p.piece_type == PIECE_QUEEN) return true;
-                break;
-            }
-        }
+    // a lone minor piece cannot force or even help mate
+    const int minors = white[PIECE_KNIGHT] + white[PIECE_BISHOP] + black[PIECE_KNIGHT] + black[PIECE_BISHOP];
+    if (minors <= 1) {
+        return true;
     }
 
-    //4.check knights
-    int knight_moves[8][2] = {{1, 2}, {1, -2}, {-1, 2}, {-1, -2}, 
-                              {2, 1}, {2, -1}, {-2, 1}, {-2, -1}};
-    for (int i = 0; i < 8; i++) {
-        int nx = kx + knight_moves[i][0];
-        int ny = ky + knight_moves[i][1];
-        if (is_valid_pos(nx, ny)) {
-            struct chess_piece p = board->board_array[ny][nx];
-            if (p.colour == enemy && p.piece_type == PIECE_KNIGHT) return true;
-        }
+    // bishops that all run on the same colour can never cover the squares a king could flee to
+    if (white[PIECE_KNIGHT] + black[PIECE_KNIGHT] == 0) {
+        const bitboard light_squares = 0x55AA55AA55AA55AAULL;
+        const bitboard bishops = board->piece_bitboards[PIECE_BISHOP];
+        return (bishops & light_squares) == 0 || (bishops & ~light_squares) == 0;
     }
+    return false;
+}
+
+int board_repetitions(const struct chess_board *board) {
+    // positions before the last capture or pawn move cannot match, nor can those with the other side to move
+    int back = board->halfmove_clock;
+    if (back > board->ply) back = board->ply;
+    if (back > BOARD_HISTORY_SIZE) back = BOARD_HISTORY_SIZE;
 
-    //5.check pawns
-    int p_dir = (enemy == PLAYER_WHITE) ? -1 : 1; 
-    int p_cols[2] = {-1, 1};
-    for (int i = 0; i < 2; i++) {
-        int nx = kx + p_cols[i];
-        int ny = ky + p_dir;
-        if (is_valid_pos(nx, ny)) {
-            struct chess_piece p = board->board_array[ny][nx];
-            if (p.colour == enemy && p.piece_type == PIECE_PAWN) return true;
+    int count = 0;
+    for (int i = 2; i <= back; i += 2) {
+        if (board->history[(board->ply - i) % BOARD_HISTORY_SIZE] == board->hash) {
+            count++;
         }
     }
-
-    return false;
+    return count;
 }
 
-//helper:check if player has any legal moves (placeholder)
-bool has_legal_moves(const struct chess_board *board, enum chess_player player) {
-    return true;
+const char *result_string(enum game_result result) {
+    switch (result) {
+        case RESULT_INCOMPLETE:
+            return "game incomplete";
+        case RESULT_WHITE_WINS:
+            return "white wins by checkmate";
+        case RESULT_BLACK_WINS:
+            return "black wins by checkmate";
+        case RESULT_STALEMATE:
+            return "draw by stalemate";
+        case RESULT_REPETITION:
+            return "draw by threefold repetition";
+        case RESULT_FIFTY_MOVES:
+            return "draw by fifty-move rule";
+        case RESULT_INSUFFICIENT_MATERIAL:
+            return "draw by insufficient material";
+    }
+    return "unknown";
 }
 
-void board_summarize(const struct chess_board *board) {
+enum game_result board_classify(const struct chess_board *board) {
     //determine whose turn it is
     enum chess_player current_player = board->next_move_player;
-    
-    //check game status
-    bool in_check = is_in_check(board, current_player);
-    bool can_move = false;//has_legal_moves(board, current_player);
 
-    if (can_move) {
-        printf("game incomplete\n");
-    } else {
-        if (in_check) {
-            if (current_player == PLAYER_WHITE)
-                printf("White wins by checkmate\n");
-            else
-                printf("Black wins by checkmate\n");
-        } else {
-            printf("draw by stalemate\n");
+    //check game status. Checkmate on the last move before the fifty-move limit still wins.
+    if (has_legal_moves(board)) {
+        if (board_insufficient_material(board)) {
+            return RESULT_INSUFFICIENT_MATERIAL;
+        }
+        if (board->halfmove_clock >= 100) {
+            return RESULT_FIFTY_MOVES;
         }
+        if (board_repetitions(board) >= 2) {
+            return RESULT_REPETITION;
+        }
+        return RESULT_INCOMPLETE;
+    }
+
+    //the player who is checkmated is the one to move, so the other player wins
+    if (is_in_check(board, current_player)) {
+        return current_player == PLAYER_WHITE ? RESULT_BLACK_WINS : RESULT_WHITE_WINS;
     }
+    return RESULT_STALEMATE;
+}
+
+void board_summarize(const struct chess_board *board) {
+    printf("%s\n", result_string(board_classify(board)));
 }
 
 //d4 Nf6 Bf4 g6 e3 Bg7 Bd3 d5 Nd2 c6 c3 Qb6 Qb3 Nbd7 Ngf3 Nh5 Qxb6 axb6 h3 Nxf4 exf4 Nf6 a3 O-O O-O Nh5 g3 Bxh3 Rfe1 e6 c4 Bg4 cxd5 exd5 Ne5 Bxe5 dxe5 c5 f3 Bd7 g4 Nxf4 Bc2 Bb5 Nb1 Rfe8 Nc3 Ba6 Ba4 Re7 Rad1 d4 Ne4 Kg7 Nd6 Nd3 Re2 Nxe5 Rf2 Nd3 Rg2 Nf4 Rh2 Ne2 Kg2 Nf4 Kg3 Nd5 Rdh1 Rh8 Bc2 Ne3 Kf4 Nxc2 Rxc2 Re2 Rcc1 Rxb2 Ne4 Rd8 Ng3 d3 Ne4 d2 Rcd1 Rd4 Ke5 Be2 Rxh7 Kxh7 Ng5 Kg7 Rh1 f6 Ke6 fxg5 a4 Bxf3 Rg1 d1=Q Rxd1 Rxd1 a5 Re2
@@ -1,6 +1,9 @@
 #ifndef APSC143__BOARD_H
 #define APSC143__BOARD_H
 #include <stdbool.h>
+#include "bitboard.h"
+#include "output.h"
+#include "status.h"
 
 enum chess_player
 {
@@ -30,41 +33,121 @@ enum castle {
     CASTLE_QUEENSIDE
 };
 
-struct chess_piece {
-    enum piece_type piece_type;
-    enum chess_player colour;
-};
+// Number of earlier positions whose keys the board remembers. A position can
+// only repeat one that came after the last capture or pawn move, and a game
+// is drawn once 100 plies pass without one, so 128 are enough.
+#define BOARD_HISTORY_SIZE 128
+
+// Value of chess_board.en_passant_square when no pawn can be taken en passant.
+#define NO_SQUARE (-1)
+
+// Bits of chess_board.castling_rights. A right is lost once the king or the
+// corresponding rook moves or the rook is captured.
+#define CASTLING_WHITE_KINGSIDE 1
+#define CASTLING_WHITE_QUEENSIDE 2
+#define CASTLING_BLACK_KINGSIDE 4
+#define CASTLING_BLACK_QUEENSIDE 8
 
-extern struct chess_piece empty_piece;
+// A piece and its owner packed into one byte: the piece type in bits 0-2 and
+// the colour in bit 3. An empty square is PIECE_EMPTY with the colour bit
+// clear.
+typedef uint8_t piece_code;
+
+#define PIECE_CODE(colour, type) ((piece_code) ((type) | ((colour) << 3)))
+#define PIECE_CODE_EMPTY ((piece_code) PIECE_EMPTY)
+#define PIECE_CODE_TYPE(code) ((enum piece_type) ((code) & 7))
+#define PIECE_CODE_COLOUR(code) ((enum chess_player) ((code) >> 3))
 
 // Gets a lowercase string denoting the piece type.
 const char *piece_string(enum piece_type piece);
 
+// Gets the letter for the piece as drawn on the board, '.' for an empty square.
+char piece_char(piece_code piece);
+
 struct chess_board
 {
     enum chess_player next_move_player;
-    struct chess_piece board_array[8][8];
 
-    // TODO: what other fields are needed?
+    // The piece on each square, indexed by SQUARE(x, y).
+    piece_code squares[64];
+
+    // Bitboards mirroring squares: one occupancy set per piece type and one per
+    // colour. Every change to squares must be made through the helpers in
+    // board.c so that both views stay in sync.
+    bitboard piece_bitboards[6];
+    bitboard colour_bitboards[2];
 
+    // Square of each player's king. Every position has exactly one king per
+    // side, so this is always valid.
+    uint8_t king_squares[2];
 
+    // Number of pieces of each type each player has, [colour][piece type].
+    uint8_t piece_counts[2][6];
+
+    // CASTLING_* bits for the castles that are still allowed.
+    uint8_t castling_rights;
+
+    // Square skipped over by a pawn double push on the previous move, if a
+    // pawn can take en passant there, or NO_SQUARE.
+    int8_t en_passant_square;
+
+    // Moves since the last capture or pawn move, for the fifty-move rule.
+    uint16_t halfmove_clock;
+
+    // Starts at 1 and goes up after each move by black.
+    uint16_t fullmove_number;
+
+    // Zobrist key of the position, see zobrist.h. Kept up to date by every
+    // change made through board.c.
+    uint64_t hash;
+
+    // Keys of the positions before each move made since the board was set up,
+    // the most recent at history[(ply - 1) % BOARD_HISTORY_SIZE]. Older keys
+    // are overwritten.
+    uint16_t ply;
+    uint64_t history[BOARD_HISTORY_SIZE];
 };
 
-struct chess_move
+// Gets the 64-bit key of the position. Positions with the same pieces, side to
+// move, castling rights and en passant square have the same key.
+static inline uint64_t board_hash(const struct chess_board *board)
 {
+    return board->hash;
+}
 
-    struct chess_piece moving_piece;
+// Gets the piece on the square, PIECE_CODE_EMPTY if there is none.
+static inline piece_code board_piece_at(const struct chess_board *board, int square)
+{
+    return board->squares[square];
+}
 
-    enum piece_type piece_type;
+// Gets the square of the given player's king.
+static inline int board_king_square(const struct chess_board *board, enum chess_player player)
+{
+    return board->king_squares[player];
+}
 
+// Squares occupied by the given player's pieces of the given type.
+static inline bitboard board_pieces(const struct chess_board *board, enum chess_player player,
+                                    enum piece_type piece)
+{
+    return board->piece_bitboards[piece] & board->colour_bitboards[player];
+}
+
+// Squares occupied by any piece.
+static inline bitboard board_occupied(const struct chess_board *board)
+{
+    return board->colour_bitboards[PLAYER_WHITE] | board->colour_bitboards[PLAYER_BLACK];
+}
+
+struct chess_move
+{
+    piece_code moving_piece;
+    enum piece_type piece_type;
 
     //Info on where the square is
-    bool source_known; //Is the source known? yes or no
-    int source_square; //What square does the source exist in the array
     int source_y; //from side of the board
-    bool source_column_check; //Did the user enter this info
     int source_x; // from bottom of the board
-    bool source_row_check;//Did the user enter this info
 
     //destination info
     int target_square_x;
@@ -76,30 +159,171 @@ struct chess_move
     enum piece_type promotion_piece;
     bool en_passant;
     enum castle castling;
+};
 
+// A complete move packed into 16 bits, for move lists and stored games:
+// bits 0-5 are the source square, bits 6-11 the target square and bits 12-15
+// the MOVE_* flags. The moving piece is not stored; it is read from the board
+// the move is played on.
+typedef uint16_t packed_move;
 
+#define MOVE_QUIET 0
+#define MOVE_DOUBLE_PUSH 1
+#define MOVE_KINGSIDE_CASTLE 2
+#define MOVE_QUEENSIDE_CASTLE 3
+#define MOVE_CAPTURE 4 // also set in en passant captures and in captures that promote
+#define MOVE_EN_PASSANT 5
+#define MOVE_PROMOTION 8 // the low two bits give the piece: knight, bishop, rook, queen
+#define MOVE_PROMOTION_TO(piece) (MOVE_PROMOTION | ((piece) - PIECE_KNIGHT))
 
-    // TODO: what other fields are needed?
-};
+#define PACK_MOVE(from, to, flags) ((packed_move) ((from) | ((to) << 6) | ((flags) << 12)))
+#define PACKED_FROM(m) ((m) & 63)
+#define PACKED_TO(m) (((m) >> 6) & 63)
+#define PACKED_FLAGS(m) ((m) >> 12)
+
+// Packs a complete move, e.g. one returned by board_complete_move.
+packed_move move_pack(const struct chess_move *move);
+
+// Expands a packed move into a complete move for the given position, which
+// must be the one the move was generated or recorded in.
+void move_unpack(const struct chess_board *board, packed_move packed, struct chess_move *move);
+
+// Writes the move in coordinate notation, e.g. e2e4 or e7e8q, as used by
+// chess engines.
+void move_to_coordinates(packed_move packed, char out[6]);
+
+// Checks that a packed move read from outside, e.g. from an archive, can be
+// unpacked and played on the board without breaking it: the piece to move
+// belongs to the player to move, a castle has its king, rook, right and empty
+// squares, an en passant capture has its pawn, a promotion is a pawn reaching
+// the last rank, and nothing takes a king or a piece of its own side. It does
+// not check that the move is legal.
+bool move_fits_board(const struct chess_board *board, packed_move packed);
+
+// Fills in the lookup tables used by the board code. Must be called once at
+// startup, before any board is set up and before starting any threads.
+void board_init_tables(void);
+
+// Computes the key of the position from scratch. It always equals
+// board_hash(board); this is for checking that it does.
+uint64_t board_compute_hash(const struct chess_board *board);
 
 // Initializes the state of the board for a new chess game.
 void board_initialize(struct chess_board *board);
 
+// Copies the board. Use this rather than assigning the struct: only the keys
+// of the history that board_repetitions can still look at are copied.
+void board_copy(struct chess_board *board, const struct chess_board *from);
+
+// Sets up the board from a position in Forsyth-Edwards Notation. Returns false
+// if the FEN is malformed or the position impossible (a side without exactly
+// one king, a pawn on the first or last rank, a side with more than 16 pieces
+// or more than 8 pawns, a side with more promoted pieces than it has missing
+// pawns, the side not to move in check, or an en passant square no double
+// push could have left), in which case the board contents are unspecified.
+// Castling rights whose king or rook is not on its home square are dropped.
+bool board_from_fen(struct chess_board *board, const char *fen);
+
+// Longest FEN that board_to_fen can write, including the terminating NUL.
+#define BOARD_FEN_MAX 96
+
+// Writes the position in Forsyth-Edwards Notation into buffer, truncating and
+// always NUL-terminating it if it does not fit in size bytes. Returns the
+// length of the full FEN, as snprintf does. Does not allocate.
+size_t board_to_fen(const struct chess_board *board, char *buffer, size_t size);
+
 // Determine which piece is moving, and complete the move data accordingly.
 // Panics if there is no piece which can make the specified move, or if there
 // are multiple possible pieces.
 void board_complete_move(const struct chess_board *board, struct chess_move *move);
 
+// Same as board_complete_move, but returns a status instead of exiting. On
+// failure, error->status and error->reason are set and the other fields of
+// *error are left for the caller to fill in.
+//
+// A move is only completed if it is legal: a castle needs its right to still
+// be held and the king may not castle out of, through or into check, and no
+// move may leave the mover's own king in check. Pieces that cannot make the
+// move for this reason do not make it ambiguous.
+//
+// For pieces other than pawns, the capture field is set from whether the
+// target square is occupied, whether or not the notation had an x, so that
+// the completed move does not depend on how it was written.
+enum chess_status board_try_complete_move(const struct chess_board *board, struct chess_move *move,
+                                          struct chess_error *error);
+
 // Apply move to the board. The move must already be complete, i.e., the initial
 // square must be known. Panics if the move is not legal in the current board
 // position.
 void board_apply_move(struct chess_board *board, const struct chess_move *move);
 
+// What board_make_move changed that cannot be worked out from the move alone,
+// so that board_unmake_move can put it back.
+struct board_undo
+{
+    uint64_t hash;
+    piece_code captured; // PIECE_CODE_EMPTY if the move captured nothing
+    uint8_t castling_rights;
+    int8_t en_passant_square;
+    uint16_t halfmove_clock;
+};
+
+// Same as board_apply_move, and fills in *undo so that the move can be taken
+// back. The undo records of a line of play are kept by the caller, e.g. one
+// per ply of a search, so that nodes never copy the whole board.
+void board_make_move(struct chess_board *board, const struct chess_move *move, struct board_undo *undo);
+
+// Takes back a move made with board_make_move. Moves must be taken back in the
+// opposite order to that in which they were made, each with its own record.
+void board_unmake_move(struct chess_board *board, const struct chess_move *move, const struct board_undo *undo);
+
+// Appends a text drawing of the board to the buffer.
+void board_render(const struct chess_board *board, struct output_buffer *out);
+
+// Prints the board to standard output.
+void board_draw(const struct chess_board *board);
+
+// Checks whether neither side has enough material left to ever checkmate: king
+// against king with at most one knight or bishop, or only bishops that all
+// stand on squares of the same colour.
+bool board_insufficient_material(const struct chess_board *board);
+
+// Counts how many times the current position occurred before, looking back
+// only as far as the last capture or pawn move. Positions are compared by key.
+int board_repetitions(const struct chess_board *board);
+
+// Checks if any piece belonging to attacker attacks the given square.
+bool is_square_attacked(const struct chess_board *board, int square, enum chess_player attacker);
+
+// Checks if the given player's king is under attack.
+bool is_in_check(const struct chess_board *board, enum chess_player player);
+
+// How a game stands after its last move.
+enum game_result
+{
+    RESULT_INCOMPLETE,
+    RESULT_WHITE_WINS,
+    RESULT_BLACK_WINS,
+    RESULT_STALEMATE,
+    RESULT_REPETITION, // the position occurred for the third time
+    RESULT_FIFTY_MOVES, // 50 moves by each side without a capture or pawn move
+    RESULT_INSUFFICIENT_MATERIAL
+};
+
+// Gets the line board_summarize prints for the result, e.g. "draw by stalemate".
+const char *result_string(enum game_result result);
+
+// Classify the state of the board without printing anything.
+enum game_result board_classify(const struct chess_board *board);
+
 // Classify the state of the board, printing one of the following:
 // - game incomplete
 // - white wins by checkmate
 // - black wins by checkmate
 // - draw by stalemate
+// - draw by threefold repetition
+// - draw by fifty-move rule
+// - draw by insufficient material
 void board_summarize(const struct chess_board *board);
 
 #endif
@@ -0,0 +1,216 @@
+#define _POSIX_C_SOURCE 200112L
+#include "input.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool input_read_stream(FILE *stream, struct input *input)
+{
+    size_t capacity = 1 << 16;
+    size_t length = 0;
+    char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        return false;
+    }
+
+    // read in large blocks, doubling the buffer as it fills
+    for (;;) {
+        length += fread(buffer + length, 1, capacity - length, stream);
+        if (length < capacity) {
+            break;
+        }
+        char *grown = realloc(buffer, capacity * 2);
+        if (grown == NULL) {
+            free(buffer);
+            return false;
+        }
+        buffer = grown;
+        capacity *= 2;
+    }
+
+    if (ferror(stream)) {
+        free(buffer);
+        return false;
+    }
+
+    input->data = buffer;
+    input->length = length;
+    input->owned = buffer;
+    input->mapping = NULL;
+    return true;
+}
+
+#ifdef _WIN32
+
+bool input_map_file(const char *path, struct input *input)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    bool ok = input_read_stream(file, input);
+    fclose(file);
+    return ok;
+}
+
+#else
+
+bool input_map_file(const char *path, struct input *input)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+
+    // pipes and other special files have no size to map, so they are read like standard input
+    if (!S_ISREG(info.st_mode)) {
+        FILE *stream = fdopen(fd, "rb");
+        if (stream == NULL) {
+            close(fd);
+            return false;
+        }
+        bool ok = input_read_stream(stream, input);
+        fclose(stream);
+        return ok;
+    }
+
+    input->owned = NULL;
+    input->mapping = NULL;
+    input->length = (size_t) info.st_size;
+
+    // an empty file cannot be mapped, but there is nothing to read anyway
+    if (input->length == 0) {
+        close(fd);
+        input->data = "";
+        return true;
+    }
+
+    void *mapping = mmap(NULL, input->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    posix_madvise(mapping, input->length, POSIX_MADV_SEQUENTIAL);
+
+    input->data = mapping;
+    input->mapping = mapping;
+    return true;
+}
+
+#endif
+
+void input_close(struct input *input)
+{
+#ifndef _WIN32
+    if (input->mapping != NULL) {
+        munmap(input->mapping, input->length);
+    }
+#endif
+    free(input->owned);
+    input->owned = NULL;
+    input->mapping = NULL;
+    input->data = NULL;
+    input->length = 0;
+}
+
+static bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Checks if the line holds anything other than whitespace.
+static bool line_has_content(const char *line, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        if (!is_blank(line[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Records a game occupying [start, end) of the input. Returns false if memory
+// runs out.
+static bool game_index_add(struct game_index *index, size_t *capacity, size_t start, size_t end)
+{
+    // one extra slot is always kept for the end offset
+    if (index->count + 2 > *capacity) {
+        size_t *grown = realloc(index->offsets, *capacity * 2 * sizeof(size_t));
+        if (grown == NULL) {
+            return false;
+        }
+        index->offsets = grown;
+        *capacity *= 2;
+    }
+    index->offsets[index->count++] = start;
+    index->offsets[index->count] = end;
+    return true;
+}
+
+bool game_index_build(const struct input *input, enum game_format format, struct game_index *index)
+{
+    size_t capacity = 1024;
+    index->count = 0;
+    index->format = format;
+    index->offsets = malloc(capacity * sizeof(size_t));
+    if (index->offsets == NULL) {
+        return false;
+    }
+    index->offsets[0] = 0;
+
+    if (format == GAME_FORMAT_PGN) {
+        // a PGN game can span any number of lines, so its end is found by skipping it with the parser; games are
+        // contiguous, each running up to the start of the next
+        struct parser parser;
+        parser_init(&parser, input->data, input->length, format);
+        for (;;) {
+            size_t start = parser.position;
+            while (start < input->length && is_blank(input->data[start])) {
+                start++;
+            }
+            if (start == input->length) {
+                break;
+            }
+            parser.position = start;
+            parser_skip_game(&parser);
+            if (!game_index_add(index, &capacity, start, parser.position)) {
+                game_index_free(index);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t start = 0;
+    while (start < input->length) {
+        const char *newline = memchr(input->data + start, '\n', input->length - start);
+        size_t end = newline ? (size_t) (newline - input->data) + 1 : input->length;
+
+        if (line_has_content(input->data + start, end - start) &&
+            !game_index_add(index, &capacity, start, end)) {
+            game_index_free(index);
+            return false;
+        }
+        start = end;
+    }
+    return true;
+}
+
+void game_index_free(struct game_index *index)
+{
+    free(index->offsets);
+    index->offsets = NULL;
+    index->count = 0;
+}
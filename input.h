@@ -0,0 +1,48 @@
+#ifndef APSC143__INPUT_H
+#define APSC143__INPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "parser.h"
+
+// The whole of an input, held in memory so that it can be parsed in place.
+struct input
+{
+    const char *data;
+    size_t length;
+
+    char *owned;    // heap buffer backing data, freed by input_close
+    void *mapping;  // memory mapping backing data, unmapped by input_close
+};
+
+// Reads the stream to its end. Returns false if reading fails or memory runs
+// out.
+bool input_read_stream(FILE *stream, struct input *input);
+
+// Maps the file read-only into memory, hinting to the kernel that it will be
+// read sequentially. Where mapping is not available, or the path is a pipe or
+// other file that is not a regular one, the file is read instead.
+// Returns false if the file cannot be opened or mapped.
+bool input_map_file(const char *path, struct input *input);
+
+// Releases the memory held by the input.
+void input_close(struct input *input);
+
+// Where each game starts in an input. Blank lines are not games. Game i
+// occupies [offsets[i], offsets[i + 1]) of the input, so any game can be
+// parsed without reading the ones before it.
+struct game_index
+{
+    size_t *offsets;
+    size_t count;
+    enum game_format format;
+};
+
+// Scans the input for game boundaries: lines, or for PGN the end of each
+// game's movetext. Returns false if memory runs out.
+bool game_index_build(const struct input *input, enum game_format format, struct game_index *index);
+
+void game_index_free(struct game_index *index);
+
+#endif
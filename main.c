@@ -1,18 +1,616 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "archive.h"
 #include "board.h"
+#include "input.h"
+#include "movegen.h"
+#include "opening_tree.h"
+#include "panic.h"
 #include "parser.h"
+#include "position_index.h"
+#include "replay.h"
+#include "search.h"
 
-int main()
+// Searches the position and appends the best move and its score, e.g.
+// "best move e2e4, score +0.30 (depth 7, 81234 nodes)". Appends nothing if
+// the game is over.
+static void append_search(struct output_buffer *out, const struct chess_board *board,
+                          const struct search_limits *limits)
 {
+    struct search_result result;
+    if (board_classify(board) != RESULT_INCOMPLETE || !board_search(board, limits, &result))
+    {
+        return;
+    }
+    char name[6];
+    move_to_coordinates(result.best_move, name);
+    if (SEARCH_IS_MATE(result.score))
+    {
+        // plies to mate, rounded up to moves of the side that mates
+        int moves = (SEARCH_MATE - abs(result.score) + 1) / 2;
+        output_appendf(out, "best move %s, %s in %d (depth %d, %lld nodes)\n", name,
+                       result.score > 0 ? "mate" : "mated", moves, result.depth, result.nodes);
+    }
+    else
+    {
+        output_appendf(out, "best move %s, score %+.2f (depth %d, %lld nodes)\n", name, result.score / 100.0,
+                       result.depth, result.nodes);
+    }
+}
+
+// Replays the first game of the input, drawing the board as the policy asks.
+// The drawings are collected and written in one go. Exits on the first bad
+// move, after writing the boards drawn up to it. If search is not NULL, the
+// final position is then searched with those limits.
+static void replay_single_game(struct parser *parser, const struct chess_board *start, enum output_policy policy,
+                               const struct search_limits *search)
+{
+    struct chess_board board;
+    struct chess_error error;
+    struct output_buffer out;
+    int move_count;
+    output_init(&out);
+
+    if (replay_game(parser, start, &board, policy, &out, NULL, &move_count, &error) != CHESS_OK)
+    {
+        output_flush(&out, stdout);
+        fflush(stdout);
+        panicf("move %d (%s): %s\n", error.move_index + 1, error.san, error.reason);
+    }
+    replay_report(&out, policy, CHESS_OK, &board, &error);
+    if (search != NULL)
+    {
+        append_search(&out, &board, search);
+    }
+    output_flush(&out, stdout);
+    output_free(&out);
+}
+
+// Tells how many games had a bad move, and why, if any did.
+static void print_skipped(long games, const long error_counts[CHESS_STATUS_COUNT])
+{
+    long failed = games - error_counts[CHESS_OK];
+    if (failed > 0)
+    {
+        fprintf(stderr, "%ld of %ld games skipped:", failed, games);
+        for (int status = CHESS_OK + 1; status < CHESS_STATUS_COUNT; status++)
+        {
+            if (error_counts[status] > 0)
+            {
+                fprintf(stderr, " %ld %s;", error_counts[status], status_string(status));
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+// Replays every game of the input, printing one summary per game in input
+// order. A game with a bad move prints an error line instead and does not stop
+// the run. Blank lines are skipped.
+static void replay_all_games(const struct input *input, enum game_format format, const struct chess_board *start,
+                             int threads, enum output_policy policy)
+{
+    struct game_index index;
+    if (!game_index_build(input, format, &index))
+    {
+        panicf("out of memory indexing games\n");
+    }
+
+    struct replay_source source = {input, &index, start, NULL};
+    long error_counts[CHESS_STATUS_COUNT];
+    replay_batch(&source, threads, policy, error_counts);
+    print_skipped((long) index.count, error_counts);
+    game_index_free(&index);
+}
+
+// Replays only the given game (counted from 1) of an indexed input, without
+// parsing any of the games before it, and searches its final position as
+// replay_single_game does.
+static void replay_indexed_game(const struct input *input, enum game_format format, long game,
+                                const struct chess_board *start, enum output_policy policy,
+                                const struct search_limits *search)
+{
+    struct game_index index;
+    if (!game_index_build(input, format, &index))
+    {
+        panicf("out of memory indexing games\n");
+    }
+    if ((size_t) game > index.count)
+    {
+        panicf("game %ld out of range: the input has %zu games\n", game, index.count);
+    }
+
+    size_t game_start = index.offsets[game - 1];
+    size_t game_end = index.offsets[game];
+    struct parser parser;
+    parser_init(&parser, input->data + game_start, game_end - game_start, format);
+
+    struct chess_board board;
+    struct chess_error error;
+    struct output_buffer out;
+    int move_count;
+    output_init(&out);
+    enum chess_status status = replay_game(&parser, start, &board, policy, &out, NULL, &move_count, &error);
+    replay_report(&out, policy, status, &board, &error);
+    if (search != NULL && status == CHESS_OK)
+    {
+        append_search(&out, &board, search);
+    }
+    output_flush(&out, stdout);
+    output_free(&out);
+    game_index_free(&index);
+}
+
+// Replays every game of the input and stores the moves in an archive at path.
+static void write_archive(const struct input *input, enum game_format format, const struct chess_board *start,
+                          const char *path)
+{
+    struct game_index index;
+    if (!game_index_build(input, format, &index))
+    {
+        panicf("out of memory indexing games\n");
+    }
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        panicf("failed to create %s\n", path);
+    }
+
+    long error_counts[CHESS_STATUS_COUNT];
+    bool written = archive_write(file, input, &index, start, error_counts);
+    if (fclose(file) != 0 || !written)
+    {
+        panicf("failed to write %s\n", path);
+    }
+    print_skipped((long) index.count, error_counts);
+    game_index_free(&index);
+}
+
+// Replays games stored by --archive: the first, the given one (counted from 1)
+// or, with multi, all of them. A single game's final position is searched as
+// replay_single_game does.
+static void replay_archive(const struct archive *archive, bool multi, long game, int threads,
+                           enum output_policy policy, const struct search_limits *search)
+{
+    if (multi && game == 0)
+    {
+        struct replay_source source = {NULL, NULL, NULL, archive};
+        long error_counts[CHESS_STATUS_COUNT];
+        replay_batch(&source, threads, policy, error_counts);
+        print_skipped((long) archive->game_count, error_counts);
+        return;
+    }
+    if (game == 0)
+    {
+        game = 1;
+    }
+    if ((size_t) game > archive->game_count)
+    {
+        panicf("game %ld out of range: the input has %zu games\n", game, archive->game_count);
+    }
+
     struct chess_board board;
-    board_initialize(&board);
+    struct chess_error error;
+    struct output_buffer out;
+    int move_count;
+    output_init(&out);
+    enum chess_status status = replay_archived_game(archive, (size_t) game - 1, &board, policy, &out, NULL,
+                                                    &move_count, &error);
+    replay_report(&out, policy, status, &board, &error);
+    if (search != NULL && status == CHESS_OK)
+    {
+        append_search(&out, &board, search);
+    }
+    output_flush(&out, stdout);
+    output_free(&out);
+}
+
+// Builds the position index of the games and writes it to path.
+static void write_position_index(const struct replay_source *source, int threads, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        panicf("failed to create %s\n", path);
+    }
 
-    struct chess_move move;
-    while (parse_move(&move))
+    long error_counts[CHESS_STATUS_COUNT];
+    bool written = position_index_write(file, source, threads, error_counts);
+    if (fclose(file) != 0 || !written)
+    {
+        panicf("failed to write %s\n", path);
+    }
+    print_skipped((long) replay_source_count(source), error_counts);
+}
+
+// Counts the games that played each move of the corpus's opening tree and
+// writes the tree to path.
+static void write_opening_tree(const struct replay_source *source, int depth, int threads, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        panicf("failed to create %s\n", path);
+    }
+
+    long error_counts[CHESS_STATUS_COUNT];
+    bool written = opening_tree_write(file, source, depth, threads, error_counts);
+    if (fclose(file) != 0 || !written)
+    {
+        panicf("failed to write %s\n", path);
+    }
+    long games = 0;
+    for (int status = 0; status < CHESS_STATUS_COUNT; status++)
+    {
+        games += error_counts[status];
+    }
+    print_skipped(games, error_counts);
+}
+
+static int compare_by_games(const void *a, const void *b)
+{
+    const struct opening_tree_entry *x = a;
+    const struct opening_tree_entry *y = b;
+    return (x->games < y->games) - (x->games > y->games);
+}
+
+// Lists the moves played from the position in an opening tree, most played
+// first, with how the games that played them ended.
+static void find_opening(const struct input *input, const struct chess_board *board)
+{
+    struct opening_tree tree;
+    if (!opening_tree_open(input, &tree))
+    {
+        panicf("damaged opening tree\n");
+    }
+
+    const struct opening_tree_entry *entries;
+    size_t count = opening_tree_find(&tree, board_hash(board), &entries);
+    struct opening_tree_entry sorted[MAX_LEGAL_MOVES];
+    if (count > MAX_LEGAL_MOVES)
+    {
+        panicf("damaged opening tree\n");
+    }
+    memcpy(sorted, entries, count * sizeof(struct opening_tree_entry));
+    qsort(sorted, count, sizeof(struct opening_tree_entry), compare_by_games);
+
+    struct output_buffer out;
+    output_init(&out);
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct opening_tree_entry *entry = &sorted[i];
+        char name[6];
+        move_to_coordinates(entry->move, name);
+        output_appendf(&out, "%s %lu games: %lu white wins, %lu draws, %lu black wins\n", name,
+                       (unsigned long) entry->games, (unsigned long) entry->white_wins,
+                       (unsigned long) entry->draws, (unsigned long) entry->black_wins);
+    }
+    output_flush(&out, stdout);
+    output_free(&out);
+}
+
+// Looks the position up in a position index, listing every game (counted
+// from 1) and ply at which it was reached, or in an opening tree.
+static void find_position(const struct input *input, const char *fen)
+{
+    struct chess_board board;
+    if (!board_from_fen(&board, fen))
+    {
+        panicf("invalid FEN: %s\n", fen);
+    }
+    if (opening_tree_detect(input))
+    {
+        find_opening(input, &board);
+        return;
+    }
+    struct position_index index;
+    if (!position_index_open(input, &index))
+    {
+        panicf("damaged position index\n");
+    }
+
+    const struct position_entry *entries;
+    size_t count = position_index_find(&index, board_hash(&board), &entries);
+    struct output_buffer out;
+    output_init(&out);
+    for (size_t i = 0; i < count; i++)
+    {
+        output_appendf(&out, "game %lu ply %lu\n", (unsigned long) entries[i].game + 1,
+                       (unsigned long) entries[i].ply);
+    }
+    output_flush(&out, stdout);
+    output_free(&out);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: chess-analysis [--multi] [--threads N] [--game N] [--fen FEN] [--output MODE]\n"
+            "                      [--archive OUT] [--position-index OUT]\n"
+            "                      [--opening-tree OUT [--depth N]]\n"
+            "                      [--search [--depth N] [--nodes N] [--time MS]] [file]\n"
+            "       chess-analysis --find FEN index\n"
+            "  Replays the game on standard input, or in file if given. Games are read as\n"
+            "  PGN if the input starts with a tag pair or a move number, otherwise as one\n"
+            "  game per line, unless it is an archive written by --archive.\n"
+            "  --multi        replay every game of the input\n"
+            "  --threads N    with --multi, replay games on N threads (0: one per core)\n"
+            "  --game N       replay only the Nth game\n"
+            "  --fen FEN      start every game without a FEN tag from this position instead\n"
+            "                 of the initial one\n"
+            "  --output MODE  what to draw for each game: quiet (the result only), final\n"
+            "                 (the final position), fen (the final position as FEN) or\n"
+            "                 moves (the position after every move); moves by default for\n"
+            "                 a single game, quiet otherwise\n"
+            "  --archive OUT  replay every game and store the moves in a binary archive at\n"
+            "                 OUT, which replays much faster than text when read back\n"
+            "  --position-index OUT\n"
+            "                 replay every game and write an index of the positions reached\n"
+            "                 to OUT; uses --threads\n"
+            "  --opening-tree OUT\n"
+            "                 replay every game and write, for each position in the first\n"
+            "                 N plies (--depth, 20 by default), how often each move was played\n"
+            "                 and how those games ended; uses --threads\n"
+            "  --search       search the final position of the game for the best move, to\n"
+            "                 --depth plies, --nodes positions or for --time milliseconds,\n"
+            "                 whichever comes first; one second if none is given. With an\n"
+            "                 empty game and --fen, this searches the given position. Not\n"
+            "                 with --multi or the options that write a file\n"
+            "  --find FEN     look the position up in a file written by --position-index,\n"
+            "                 listing the games and plies that reached it, or by\n"
+            "                 --opening-tree, listing the moves played from it\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    bool multi = false;
+    int threads = 1;
+    long game = 0;
+    int policy = -1;
+    const char *fen = NULL;
+    const char *path = NULL;
+    const char *archive_path = NULL;
+    const char *position_index_path = NULL;
+    const char *find_fen = NULL;
+    const char *opening_tree_path = NULL;
+    int depth = 0;
+    bool search = false;
+    struct search_limits limits = {0, 0, 0};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--multi") == 0)
+        {
+            multi = true;
+        }
+        else if (strcmp(argv[i], "--game") == 0 && i + 1 < argc)
+        {
+            game = strtol(argv[++i], NULL, 10);
+            if (game < 1)
+            {
+                usage();
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+            if (threads < 0)
+            {
+                usage();
+            }
+            if (threads == 0)
+            {
+                threads = replay_default_threads();
+            }
+        }
+        else if (strcmp(argv[i], "--fen") == 0 && i + 1 < argc)
+        {
+            fen = argv[++i];
+        }
+        else if (strcmp(argv[i], "--archive") == 0 && i + 1 < argc)
+        {
+            archive_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--position-index") == 0 && i + 1 < argc)
+        {
+            position_index_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--opening-tree") == 0 && i + 1 < argc)
+        {
+            opening_tree_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+        {
+            depth = atoi(argv[++i]);
+            if (depth < 1)
+            {
+                usage();
+            }
+        }
+        else if (strcmp(argv[i], "--search") == 0)
+        {
+            search = true;
+        }
+        else if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc)
+        {
+            limits.nodes = atoll(argv[++i]);
+            if (limits.nodes < 1)
+            {
+                usage();
+            }
+        }
+        else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+        {
+            limits.milliseconds = atol(argv[++i]);
+            if (limits.milliseconds < 1)
+            {
+                usage();
+            }
+        }
+        else if (strcmp(argv[i], "--find") == 0 && i + 1 < argc)
+        {
+            find_fen = argv[++i];
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "quiet") == 0)
+            {
+                policy = OUTPUT_QUIET;
+            }
+            else if (strcmp(mode, "final") == 0)
+            {
+                policy = OUTPUT_FINAL;
+            }
+            else if (strcmp(mode, "fen") == 0)
+            {
+                policy = OUTPUT_FEN;
+            }
+            else if (strcmp(mode, "moves") == 0)
+            {
+                policy = OUTPUT_EVERY_MOVE;
+            }
+            else
+            {
+                usage();
+            }
+        }
+        else if (argv[i][0] != '-' && path == NULL)
+        {
+            path = argv[i];
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    board_init_tables();
+
+    // --depth counts plies for both the opening tree and the search; a search with no limit at all gets a second
+    limits.depth = depth;
+    if (limits.depth == 0 && limits.nodes == 0 && limits.milliseconds == 0)
+    {
+        limits.milliseconds = 1000;
+    }
+    if (depth == 0)
+    {
+        depth = OPENING_TREE_DEFAULT_DEPTH;
+    }
+    const struct search_limits *search_limits = search ? &limits : NULL;
+    // a search is made of one game's final position, so it does not go with the options that replay them all
+    if (search && (multi || archive_path != NULL || position_index_path != NULL || opening_tree_path != NULL))
+    {
+        usage();
+    }
+
+    struct chess_board start;
+    if (fen != NULL && !board_from_fen(&start, fen))
+    {
+        panicf("invalid FEN: %s\n", fen);
+    }
+    const struct chess_board *start_position = fen != NULL ? &start : NULL;
+
+    // a file is mapped and parsed in place; standard input has to be read into memory first
+    struct input input;
+    if (path != NULL)
+    {
+        if (!input_map_file(path, &input))
+        {
+            panicf("failed to open %s\n", path);
+        }
+    }
+    else if (!input_read_stream(stdin, &input))
+    {
+        panicf("failed to read standard input\n");
+    }
+
+    // drawing every move of thousands of games is rarely wanted, so only a plain single game draws by default
+    if (policy < 0)
+    {
+        policy = (game != 0 || multi || search) ? OUTPUT_QUIET : OUTPUT_EVERY_MOVE;
+    }
+
+    bool lookup_input = position_index_detect(&input) || opening_tree_detect(&input);
+    if (find_fen != NULL || lookup_input)
+    {
+        if (find_fen == NULL || !lookup_input)
+        {
+            panicf("--find needs a position index or opening tree, which are only read by --find\n");
+        }
+        find_position(&input, find_fen);
+        input_close(&input);
+        return 0;
+    }
+
+    if (archive_detect(&input))
+    {
+        struct archive archive;
+        if (!archive_open(&input, &archive))
+        {
+            panicf("damaged archive\n");
+        }
+        if (fen != NULL || archive_path != NULL)
+        {
+            panicf("--fen and --archive cannot be used when reading an archive\n");
+        }
+        struct replay_source source = {NULL, NULL, NULL, &archive};
+        if (position_index_path != NULL)
+        {
+            write_position_index(&source, threads, position_index_path);
+        }
+        else if (opening_tree_path != NULL)
+        {
+            write_opening_tree(&source, depth, threads, opening_tree_path);
+        }
+        else
+        {
+            replay_archive(&archive, multi, game, threads, (enum output_policy) policy, search_limits);
+        }
+        input_close(&input);
+        return 0;
+    }
+
+    enum game_format format = parser_detect_format(input.data, input.length);
+    struct parser parser;
+    parser_init(&parser, input.data, input.length, format);
+    if (archive_path != NULL)
+    {
+        write_archive(&input, format, start_position, archive_path);
+    }
+    else if (position_index_path != NULL || opening_tree_path != NULL)
+    {
+        struct game_index index;
+        if (!game_index_build(&input, format, &index))
+        {
+            panicf("out of memory indexing games\n");
+        }
+        struct replay_source source = {&input, &index, start_position, NULL};
+        if (position_index_path != NULL)
+        {
+            write_position_index(&source, threads, position_index_path);
+        }
+        else
+        {
+            write_opening_tree(&source, depth, threads, opening_tree_path);
+        }
+        game_index_free(&index);
+    }
+    else if (game != 0)
+    {
+        replay_indexed_game(&input, format, game, start_position, (enum output_policy) policy, search_limits);
+    }
+    else if (multi)
+    {
+        replay_all_games(&input, format, start_position, threads, (enum output_policy) policy);
+    }
+    else
     {
-        board_complete_move(&board, &move);
-        board_apply_move(&board, &move);
+        replay_single_game(&parser, start_position, (enum output_policy) policy, search_limits);
     }
 
-    board_summarize(&board);
+    input_close(&input);
     return 0;
 }
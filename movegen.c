@@ -0,0 +1,227 @@
+#include "movegen.h"
+
+// Legal move generation without trial moves. Before generating anything, the
+// pieces giving check and the pieces pinned to their own king are found, and
+// every move is restricted to:
+// - the check mask: the checking piece and the squares between it and the king,
+//   or every square when the king is not in check;
+// - for a pinned piece, the ray between the king and the pinning piece.
+// Only king moves and en passant captures need an attack test on the resulting
+// occupancy.
+
+// state shared by the generation helpers for one position
+struct movegen
+{
+    const struct chess_board *board;
+    struct chess_move_list *list;
+    enum chess_player us;
+    enum chess_player them;
+    int king;
+    bitboard occupied;
+    bitboard check_mask;
+    bitboard pinned;
+    bitboard pin_rays[64]; // only valid for squares in pinned
+};
+
+// Enemy pieces attacking the square if the board had the given occupancy.
+static bitboard attackers(const struct movegen *gen, int square, bitboard occupied) {
+    const struct chess_board *board = gen->board;
+    const bitboard queens = board_pieces(board, gen->them, PIECE_QUEEN);
+
+    return (pawn_attacks(square, gen->us) & board_pieces(board, gen->them, PIECE_PAWN)) |
+           (knight_attacks(square) & board_pieces(board, gen->them, PIECE_KNIGHT)) |
+           (king_attacks(square) & board_pieces(board, gen->them, PIECE_KING)) |
+           (bishop_attacks(square, occupied) & (board_pieces(board, gen->them, PIECE_BISHOP) | queens)) |
+           (rook_attacks(square, occupied) & (board_pieces(board, gen->them, PIECE_ROOK) | queens));
+}
+
+static void add_move(struct movegen *gen, int from, int to, int flags) {
+    if (gen->occupied & SQUARE_BIT(to)) {
+        flags |= MOVE_CAPTURE;
+    }
+    gen->list->moves[gen->list->count++] = PACK_MOVE(from, to, flags);
+}
+
+// adds one move for each target square
+static void add_moves(struct movegen *gen, int from, bitboard targets) {
+    while (targets) {
+        add_move(gen, from, bitboard_pop_lsb(&targets), MOVE_QUIET);
+    }
+}
+
+// adds a pawn move, expanding moves onto the last rank into the four promotions
+static void add_pawn_move(struct movegen *gen, int from, int to) {
+    if (SQUARE_BIT(to) & (RANK_1_MASK | RANK_8_MASK)) {
+        add_move(gen, from, to, MOVE_PROMOTION_TO(PIECE_QUEEN));
+        add_move(gen, from, to, MOVE_PROMOTION_TO(PIECE_ROOK));
+        add_move(gen, from, to, MOVE_PROMOTION_TO(PIECE_BISHOP));
+        add_move(gen, from, to, MOVE_PROMOTION_TO(PIECE_KNIGHT));
+    } else {
+        add_move(gen, from, to, MOVE_QUIET);
+    }
+}
+
+// Targets a piece on the square may move to without exposing its king.
+static bitboard allowed_targets(const struct movegen *gen, int square) {
+    if (gen->pinned & SQUARE_BIT(square)) {
+        return gen->check_mask & gen->pin_rays[square];
+    }
+    return gen->check_mask;
+}
+
+static void find_pins(struct movegen *gen) {
+    const struct chess_board *board = gen->board;
+    const bitboard enemy = board->colour_bitboards[gen->them];
+    const bitboard queens = board_pieces(board, gen->them, PIECE_QUEEN);
+
+    // enemy sliders that would attack the king if none of our pieces were in the way
+    bitboard snipers = (rook_attacks(gen->king, enemy) & (board_pieces(board, gen->them, PIECE_ROOK) | queens)) |
+                       (bishop_attacks(gen->king, enemy) & (board_pieces(board, gen->them, PIECE_BISHOP) | queens));
+
+    gen->pinned = 0;
+    while (snipers) {
+        const int sniper = bitboard_pop_lsb(&snipers);
+        const bitboard ray = squares_between(gen->king, sniper);
+        const bitboard blockers = ray & gen->occupied;
+
+        // a single friendly piece between the sniper and the king is pinned to the ray
+        if (blockers && !bitboard_several(blockers) && (blockers & board->colour_bitboards[gen->us])) {
+            const int square = bitboard_lsb(blockers);
+            gen->pinned |= blockers;
+            gen->pin_rays[square] = ray | SQUARE_BIT(sniper);
+        }
+    }
+}
+
+static void generate_pawn_moves(struct movegen *gen) {
+    const struct chess_board *board = gen->board;
+    const bitboard enemy = board->colour_bitboards[gen->them];
+    const int push = (gen->us == PLAYER_WHITE) ? 8 : -8;
+    const int start_rank = (gen->us == PLAYER_WHITE) ? 1 : 6;
+
+    bitboard pawns = board_pieces(board, gen->us, PIECE_PAWN);
+    while (pawns) {
+        const int from = bitboard_pop_lsb(&pawns);
+        const bitboard allowed = allowed_targets(gen, from);
+
+        // pushes; a pawn can never stand on the last rank, so from + push is always on the board
+        const int to = from + push;
+        if (!(gen->occupied & SQUARE_BIT(to))) {
+            if (allowed & SQUARE_BIT(to)) {
+                add_pawn_move(gen, from, to);
+            }
+            const int to2 = to + push;
+            if (SQUARE_RANK(from) == start_rank && !(gen->occupied & SQUARE_BIT(to2)) && (allowed & SQUARE_BIT(to2))) {
+                add_move(gen, from, to2, MOVE_DOUBLE_PUSH);
+            }
+        }
+
+        // captures
+        bitboard captures = pawn_attacks(from, gen->us) & enemy & allowed;
+        while (captures) {
+            add_pawn_move(gen, from, bitboard_pop_lsb(&captures));
+        }
+
+        // en passant removes two pawns from the same rank at once, which can uncover a slider on the king, so it is
+        // checked against the resulting occupancy rather than the pin and check masks
+        if (board->en_passant_square != NO_SQUARE) {
+            const int ep = board->en_passant_square;
+            const int captured = ep - push;
+            if (pawn_attacks(from, gen->us) & SQUARE_BIT(ep)) {
+                const bitboard occupied = (gen->occupied ^ SQUARE_BIT(from) ^ SQUARE_BIT(captured)) | SQUARE_BIT(ep);
+                const bitboard remaining = attackers(gen, gen->king, occupied) & ~SQUARE_BIT(captured);
+                if (!remaining) {
+                    add_move(gen, from, ep, MOVE_EN_PASSANT);
+                }
+            }
+        }
+    }
+}
+
+static void generate_piece_moves(struct movegen *gen, enum piece_type piece) {
+    const struct chess_board *board = gen->board;
+    const bitboard own = board->colour_bitboards[gen->us];
+
+    bitboard pieces = board_pieces(board, gen->us, piece);
+    while (pieces) {
+        const int from = bitboard_pop_lsb(&pieces);
+        bitboard targets;
+        switch (piece) {
+            case PIECE_KNIGHT:
+                targets = knight_attacks(from);
+                break;
+            case PIECE_BISHOP:
+                targets = bishop_attacks(from, gen->occupied);
+                break;
+            case PIECE_ROOK:
+                targets = rook_attacks(from, gen->occupied);
+                break;
+            default:
+                targets = queen_attacks(from, gen->occupied);
+                break;
+        }
+        add_moves(gen, from, targets & ~own & allowed_targets(gen, from));
+    }
+}
+
+static void generate_castling(struct movegen *gen) {
+    const struct chess_board *board = gen->board;
+    const int y = (gen->us == PLAYER_WHITE) ? 0 : 7;
+    const uint8_t kingside = (gen->us == PLAYER_WHITE) ? CASTLING_WHITE_KINGSIDE : CASTLING_BLACK_KINGSIDE;
+    const uint8_t queenside = (gen->us == PLAYER_WHITE) ? CASTLING_WHITE_QUEENSIDE : CASTLING_BLACK_QUEENSIDE;
+
+    // the king may not pass through or land on an attacked square; the rook's path only needs to be empty
+    if ((board->castling_rights & kingside) &&
+        !(gen->occupied & (0x60ULL << (y * 8))) &&
+        !attackers(gen, SQUARE(5, y), gen->occupied) &&
+        !attackers(gen, SQUARE(6, y), gen->occupied)) {
+        add_move(gen, SQUARE(4, y), SQUARE(6, y), MOVE_KINGSIDE_CASTLE);
+    }
+    if ((board->castling_rights & queenside) &&
+        !(gen->occupied & (0x0EULL << (y * 8))) &&
+        !attackers(gen, SQUARE(3, y), gen->occupied) &&
+        !attackers(gen, SQUARE(2, y), gen->occupied)) {
+        add_move(gen, SQUARE(4, y), SQUARE(2, y), MOVE_QUEENSIDE_CASTLE);
+    }
+}
+
+int board_generate_moves(const struct chess_board *board, struct chess_move_list *list) {
+    struct movegen gen;
+    gen.board = board;
+    gen.list = list;
+    gen.us = board->next_move_player;
+    gen.them = (gen.us == PLAYER_WHITE) ? PLAYER_BLACK : PLAYER_WHITE;
+    gen.occupied = board_occupied(board);
+    gen.king = board_king_square(board, gen.us);
+    list->count = 0;
+
+    // King moves are tested with the king removed from the board, so that it cannot hide behind itself from a
+    // slider it is moving away from.
+    const bitboard without_king = gen.occupied ^ SQUARE_BIT(gen.king);
+    bitboard targets = king_attacks(gen.king) & ~board->colour_bitboards[gen.us];
+    while (targets) {
+        const int to = bitboard_pop_lsb(&targets);
+        if (!attackers(&gen, to, without_king)) {
+            add_move(&gen, gen.king, to, MOVE_QUIET);
+        }
+    }
+
+    // in double check only the king can move
+    const bitboard checkers = attackers(&gen, gen.king, gen.occupied);
+    if (bitboard_several(checkers)) {
+        return list->count;
+    }
+    gen.check_mask = checkers ? checkers | squares_between(gen.king, bitboard_lsb(checkers)) : ~0ULL;
+
+    find_pins(&gen);
+    generate_pawn_moves(&gen);
+    generate_piece_moves(&gen, PIECE_KNIGHT);
+    generate_piece_moves(&gen, PIECE_BISHOP);
+    generate_piece_moves(&gen, PIECE_ROOK);
+    generate_piece_moves(&gen, PIECE_QUEEN);
+    if (!checkers) {
+        generate_castling(&gen);
+    }
+
+    return list->count;
+}
@@ -0,0 +1,26 @@
+#ifndef APSC143__MOVEGEN_H
+#define APSC143__MOVEGEN_H
+
+#include "board.h"
+
+// No legal chess position has more than 218 moves.
+#define MAX_LEGAL_MOVES 256
+
+// Packed, so that a whole list is about half a kilobyte and stays in the L1
+// cache while it is searched.
+struct chess_move_list
+{
+    int count;
+    packed_move moves[MAX_LEGAL_MOVES];
+};
+
+// Fills list with every legal move for the player to move and returns the
+// number of moves. Each move expands with move_unpack into a complete move
+// that can be passed straight to board_make_move. Does not allocate. The list
+// is written without a bound check, so the board must have been set up by
+// board_initialize or by a board_from_fen that succeeded, and changed only by
+// playing moves: a board built any other way can have more moves than the
+// list holds.
+int board_generate_moves(const struct chess_board *board, struct chess_move_list *list);
+
+#endif
@@ -0,0 +1,310 @@
+#include "opening_tree.h"
+#include <stdlib.h>
+#include <string.h>
+#include "array.h"
+
+// An open-addressing table of entries keyed by position and move, with linear
+// probing. A slot with no games is empty. The table doubles before it gets
+// three quarters full, which keeps probe runs short.
+struct tree_table
+{
+    struct opening_tree_entry *slots;
+    size_t mask; // capacity - 1, the capacity being a power of two
+    size_t count;
+};
+
+static bool table_init(struct tree_table *table, size_t capacity)
+{
+    table->slots = calloc(capacity, sizeof(struct opening_tree_entry));
+    table->mask = capacity - 1;
+    table->count = 0;
+    return table->slots != NULL;
+}
+
+static size_t table_home(const struct tree_table *table, uint64_t hash, packed_move move)
+{
+    // the keys are already random; the move is mixed in so that the moves from one position spread out
+    return (size_t) (hash ^ ((uint64_t) move * 0x9e3779b97f4a7c15ull)) & table->mask;
+}
+
+static bool table_grow(struct tree_table *table)
+{
+    struct tree_table grown;
+    if (!table_init(&grown, (table->mask + 1) * 2)) {
+        return false;
+    }
+    for (size_t i = 0; i <= table->mask; i++) {
+        const struct opening_tree_entry *entry = &table->slots[i];
+        if (entry->games != 0) {
+            size_t slot = table_home(&grown, entry->hash, entry->move);
+            while (grown.slots[slot].games != 0) {
+                slot = (slot + 1) & grown.mask;
+            }
+            grown.slots[slot] = *entry;
+        }
+    }
+    grown.count = table->count;
+    free(table->slots);
+    *table = grown;
+    return true;
+}
+
+// Finds the entry for the move from the position, adding an empty one if
+// there is none. The pointer is only good until the next call. Returns NULL
+// if memory runs out.
+static struct opening_tree_entry *table_entry(struct tree_table *table, uint64_t hash, packed_move move)
+{
+    if ((table->count + 1) * 4 > (table->mask + 1) * 3 && !table_grow(table)) {
+        return NULL;
+    }
+    size_t slot = table_home(table, hash, move);
+    for (;;) {
+        struct opening_tree_entry *entry = &table->slots[slot];
+        if (entry->games == 0) {
+            entry->hash = hash;
+            entry->move = move;
+            table->count++;
+            return entry;
+        }
+        if (entry->hash == hash && entry->move == move) {
+            return entry;
+        }
+        slot = (slot + 1) & table->mask;
+    }
+}
+
+// Adds the counts of one entry to another.
+static void entry_add(struct opening_tree_entry *entry, const struct opening_tree_entry *counts)
+{
+    entry->games += counts->games;
+    entry->white_wins += counts->white_wins;
+    entry->draws += counts->draws;
+    entry->black_wins += counts->black_wins;
+}
+
+// A thread's share of the work: its own table, so that threads never contend
+// on the counts, merged into one when all are done.
+struct tree_worker
+{
+    struct tree_table table;
+    long error_counts[CHESS_STATUS_COUNT];
+    bool ok;
+
+    // the distinct key and move pairs of the first depth plies of the game being replayed
+    int depth;
+    uint64_t *keys;
+    packed_move *moves;
+    int count;
+    enum recorded_result recorded;
+};
+
+struct tree_batch
+{
+    const struct replay_source *source;
+    struct tree_worker *workers;
+};
+
+// Records a move of the first depth plies, unless the game already played it
+// from the same position, so that a game counts at most once for each entry.
+static void record_ply(void *context, const struct replay_step *step)
+{
+    struct tree_worker *worker = context;
+    if (step->ply == 0 || step->ply > worker->depth) {
+        return;
+    }
+    for (int i = 0; i < worker->count; i++) {
+        if (worker->keys[i] == step->previous_hash && worker->moves[i] == step->move) {
+            return;
+        }
+    }
+    worker->keys[worker->count] = step->previous_hash;
+    worker->moves[worker->count++] = step->move;
+}
+
+static void record_result(void *context, enum recorded_result result)
+{
+    struct tree_worker *worker = context;
+    worker->recorded = result;
+}
+
+// Sets the result counts of a game that could be replayed to its end: the
+// result it records for itself if it has one, as most games end by
+// resignation, on time or by agreement, otherwise what its final position
+// shows.
+static void count_result(struct opening_tree_entry *counts, enum recorded_result recorded,
+                         const struct chess_board *board)
+{
+    counts->games = 1;
+    if (recorded != RECORDED_NONE) {
+        counts->white_wins = recorded == RECORDED_WHITE_WINS;
+        counts->black_wins = recorded == RECORDED_BLACK_WINS;
+        counts->draws = recorded == RECORDED_DRAW;
+        return;
+    }
+    enum game_result result = board_classify(board);
+    counts->white_wins = result == RESULT_WHITE_WINS;
+    counts->black_wins = result == RESULT_BLACK_WINS;
+    counts->draws = result != RESULT_INCOMPLETE && result != RESULT_WHITE_WINS && result != RESULT_BLACK_WINS;
+}
+
+// Replays a range of games, counting the opening plies of each game that
+// could be replayed to its end.
+static void count_range(void *context, int thread, size_t range, size_t first, size_t end)
+{
+    const struct tree_batch *batch = context;
+    struct tree_worker *worker = &batch->workers[thread];
+    struct replay_visitor visitor = {record_ply, record_result, worker};
+    struct chess_board board;
+    struct chess_error error;
+    (void) range;
+
+    for (size_t game = first; game < end && worker->ok; game++) {
+        int move_count;
+        worker->count = 0;
+        worker->recorded = RECORDED_NONE;
+        enum chess_status status = replay_source_game(batch->source, game, &board, OUTPUT_QUIET, NULL, &visitor,
+                                                      &move_count, &error);
+        worker->error_counts[status]++;
+        if (status != CHESS_OK) {
+            continue;
+        }
+
+        struct opening_tree_entry counts = {0};
+        count_result(&counts, worker->recorded, &board);
+        for (int ply = 0; ply < worker->count; ply++) {
+            struct opening_tree_entry *entry = table_entry(&worker->table, worker->keys[ply], worker->moves[ply]);
+            if (entry == NULL) {
+                worker->ok = false;
+                break;
+            }
+            entry_add(entry, &counts);
+        }
+    }
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct opening_tree_entry *x = a;
+    const struct opening_tree_entry *y = b;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return (x->move > y->move) - (x->move < y->move);
+}
+
+bool opening_tree_write(FILE *stream, const struct replay_source *source, int depth, int threads,
+                        long error_counts[CHESS_STATUS_COUNT])
+{
+    if (threads < 1) {
+        threads = 1;
+    }
+    struct tree_batch batch;
+    batch.source = source;
+    batch.workers = calloc((size_t) threads, sizeof(struct tree_worker));
+    if (batch.workers == NULL) {
+        return false;
+    }
+    bool ok = true;
+    for (int i = 0; i < threads; i++) {
+        struct tree_worker *worker = &batch.workers[i];
+        worker->depth = depth;
+        worker->keys = malloc((size_t) depth * sizeof(uint64_t));
+        worker->moves = malloc((size_t) depth * sizeof(packed_move));
+        worker->ok = table_init(&worker->table, 1 << 16) && worker->keys != NULL && worker->moves != NULL;
+        ok = ok && worker->ok;
+    }
+
+    if (ok) {
+        replay_pool_run(replay_source_count(source), threads, count_range, NULL, &batch);
+    }
+    for (int status = 0; status < CHESS_STATUS_COUNT; status++) {
+        error_counts[status] = 0;
+    }
+    for (int i = 0; i < threads; i++) {
+        struct tree_worker *worker = &batch.workers[i];
+        ok = ok && worker->ok;
+        for (int status = 0; status < CHESS_STATUS_COUNT; status++) {
+            error_counts[status] += worker->error_counts[status];
+        }
+        free(worker->keys);
+        free(worker->moves);
+    }
+
+    // merge every partial table into the first, freeing each as it is done
+    struct tree_table *table = &batch.workers[0].table;
+    for (int i = 1; i < threads; i++) {
+        struct tree_table *partial = &batch.workers[i].table;
+        for (size_t slot = 0; ok && slot <= partial->mask; slot++) {
+            const struct opening_tree_entry *counts = &partial->slots[slot];
+            if (counts->games != 0) {
+                struct opening_tree_entry *entry = table_entry(table, counts->hash, counts->move);
+                if (entry == NULL) {
+                    ok = false;
+                    break;
+                }
+                entry_add(entry, counts);
+            }
+        }
+        free(partial->slots);
+    }
+
+    if (ok) {
+        // pack the entries to the front of the table and sort them there
+        size_t count = 0;
+        for (size_t slot = 0; slot <= table->mask; slot++) {
+            if (table->slots[slot].games != 0) {
+                table->slots[count++] = table->slots[slot];
+            }
+        }
+        qsort(table->slots, count, sizeof(struct opening_tree_entry), compare_entries);
+
+        struct opening_tree_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, OPENING_TREE_MAGIC, sizeof(header.magic));
+        header.version = OPENING_TREE_VERSION;
+        header.depth = (uint32_t) depth;
+        header.entry_count = count;
+        header.game_count = (uint64_t) error_counts[CHESS_OK];
+        ok = fwrite(&header, sizeof(header), 1, stream) == 1 &&
+             fwrite(table->slots, sizeof(struct opening_tree_entry), count, stream) == count &&
+             fflush(stream) == 0;
+    }
+    free(table->slots);
+    free(batch.workers);
+    return ok;
+}
+
+bool opening_tree_detect(const struct input *input)
+{
+    return input->length >= sizeof(struct opening_tree_header) &&
+           memcmp(input->data, OPENING_TREE_MAGIC, sizeof(((struct opening_tree_header *) 0)->magic)) == 0;
+}
+
+bool opening_tree_open(const struct input *input, struct opening_tree *tree)
+{
+    if (!opening_tree_detect(input)) {
+        return false;
+    }
+    const struct opening_tree_header *header = (const struct opening_tree_header *) input->data;
+    size_t available = input->length - sizeof(struct opening_tree_header);
+    if (header->version != OPENING_TREE_VERSION ||
+        header->entry_count > available / sizeof(struct opening_tree_entry)) {
+        return false;
+    }
+    tree->entries = (const struct opening_tree_entry *) (header + 1);
+    tree->entry_count = header->entry_count;
+    tree->game_count = header->game_count;
+    tree->depth = (int) header->depth;
+    return true;
+}
+
+size_t opening_tree_find(const struct opening_tree *tree, uint64_t hash, const struct opening_tree_entry **first)
+{
+    size_t low = array_lower_bound(tree->entries, tree->entry_count, sizeof(struct opening_tree_entry), hash);
+    size_t end = low;
+    while (end < tree->entry_count && tree->entries[end].hash == hash) {
+        end++;
+    }
+    *first = tree->entries + low;
+    return end - low;
+}
@@ -0,0 +1,83 @@
+#ifndef APSC143__OPENING_TREE_H
+#define APSC143__OPENING_TREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "archive.h"
+#include "board.h"
+#include "input.h"
+#include "replay.h"
+#include "status.h"
+
+// A file counting, for every position reached in the first plies of a set of
+// games, how often each move was played from it and how the games that played
+// it ended. The layout is:
+//
+//   struct opening_tree_header
+//   struct opening_tree_entry   entries[entry_count]
+//
+// with the entries sorted by position key, then by move. Like an archive, it
+// is stored in the byte order of the machine that wrote it.
+
+#define OPENING_TREE_MAGIC "CHESSOPT"
+#define OPENING_TREE_VERSION 1
+
+// How many plies of each game go into the tree unless asked otherwise.
+#define OPENING_TREE_DEFAULT_DEPTH 20
+
+struct opening_tree_header
+{
+    char magic[8]; // OPENING_TREE_MAGIC, without a NUL
+    uint32_t version;
+    uint32_t depth;
+    uint64_t entry_count;
+    uint64_t game_count; // games counted, which leaves out games with a bad move
+};
+
+// A move from a position, and the results of the games that played it. A game
+// counts with the result it records for itself, or else with what its final
+// position shows; games with neither are counted in games but in none of the
+// results.
+struct opening_tree_entry
+{
+    uint64_t hash;
+    uint32_t games;
+    uint32_t white_wins;
+    uint32_t draws;
+    uint32_t black_wins;
+    packed_move move;
+    uint16_t reserved[3];
+};
+
+// Replays every game of the source on the given number of threads, counting
+// the moves of the first depth plies of each, and writes the tree to the
+// stream. A game that repeats a move from the same position counts once for
+// it. error_counts[status] is set to the number of games that ended with
+// each status; games with a bad move are left out of the tree. Returns false
+// if writing fails or memory runs out.
+bool opening_tree_write(FILE *stream, const struct replay_source *source, int depth, int threads,
+                        long error_counts[CHESS_STATUS_COUNT]);
+
+// An opening tree read in place from an input, which must outlive it.
+struct opening_tree
+{
+    const struct opening_tree_entry *entries;
+    size_t entry_count;
+    size_t game_count;
+    int depth;
+};
+
+// Checks if the input starts like an opening tree.
+bool opening_tree_detect(const struct input *input);
+
+// Reads the opening tree held in the input. Returns false if it is not a tree
+// or is truncated.
+bool opening_tree_open(const struct input *input, struct opening_tree *tree);
+
+// Finds the moves played from the position with the given key. Sets *first to
+// the first of them and returns how many there are.
+size_t opening_tree_find(const struct opening_tree *tree, uint64_t hash, const struct opening_tree_entry **first);
+
+#endif
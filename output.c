@@ -0,0 +1,78 @@
+#include "output.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "panic.h"
+
+void output_init(struct output_buffer *out)
+{
+    out->data = NULL;
+    out->length = 0;
+    out->capacity = 0;
+}
+
+// Makes room for at least extra more bytes.
+static void output_reserve(struct output_buffer *out, size_t extra)
+{
+    if (out->length + extra <= out->capacity) {
+        return;
+    }
+    size_t capacity = out->capacity ? out->capacity : 4096;
+    while (capacity < out->length + extra) {
+        capacity *= 2;
+    }
+    char *grown = realloc(out->data, capacity);
+    if (grown == NULL) {
+        panicf("out of memory buffering output\n");
+    }
+    out->data = grown;
+    out->capacity = capacity;
+}
+
+void output_append(struct output_buffer *out, const char *text, size_t length)
+{
+    output_reserve(out, length);
+    memcpy(out->data + out->length, text, length);
+    out->length += length;
+}
+
+void output_append_line(struct output_buffer *out, const char *line)
+{
+    size_t length = strlen(line);
+    output_reserve(out, length + 1);
+    memcpy(out->data + out->length, line, length);
+    out->data[out->length + length] = '\n';
+    out->length += length + 1;
+}
+
+void output_appendf(struct output_buffer *out, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+
+    // room for the terminating NUL that vsnprintf writes, which is not kept
+    output_reserve(out, (size_t) length + 1);
+    va_start(args, format);
+    vsnprintf(out->data + out->length, (size_t) length + 1, format, args);
+    va_end(args);
+    out->length += (size_t) length;
+}
+
+void output_flush(struct output_buffer *out, FILE *stream)
+{
+    if (out->length > 0) {
+        fwrite(out->data, 1, out->length, stream);
+        out->length = 0;
+    }
+}
+
+void output_free(struct output_buffer *out)
+{
+    free(out->data);
+    output_init(out);
+}
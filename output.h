@@ -0,0 +1,34 @@
+#ifndef APSC143__OUTPUT_H
+#define APSC143__OUTPUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Text collected in memory and written out with a single call, so that many
+// small results do not each cost a stdio call, and so that results produced on
+// different threads can be written in order.
+struct output_buffer
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+void output_init(struct output_buffer *out);
+
+// Appends the text, growing the buffer as needed. Exits if memory runs out.
+void output_append(struct output_buffer *out, const char *text, size_t length);
+
+// Appends a line of text, adding the newline.
+void output_append_line(struct output_buffer *out, const char *line);
+
+// Appends formatted text, in the same form as printf.
+void output_appendf(struct output_buffer *out, const char *format, ...);
+
+// Writes the buffered text to the stream and empties the buffer, keeping its
+// memory for reuse.
+void output_flush(struct output_buffer *out, FILE *stream);
+
+void output_free(struct output_buffer *out);
+
+#endif
@@ -1,189 +1,463 @@
 #include "parser.h"
-#include <stdio.h>
-#include "panic.h"
+#include <string.h>
 #include "board.h"
 
-bool parse_move(struct chess_move *move)
+static bool is_file(char c)
+{
+    return c >= 'a' && c <= 'h';
+}
+
+static bool is_rank(char c)
+{
+    return c >= '1' && c <= '8';
+}
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Whitespace between PGN tokens, where line breaks carry no meaning.
+static bool is_pgn_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Characters that end a PGN move token even without a space before them.
+static bool is_pgn_delimiter(char c)
+{
+    return is_pgn_space(c) || c == '{' || c == '(' || c == ')' || c == ';' || c == '$' || c == '[';
+}
+
+// Check and mate marks and annotations a move can end with.
+static bool is_move_suffix(char c)
+{
+    return c == '+' || c == '#' || c == '!' || c == '?';
+}
+
+// Converts a piece letter, as used for pieces and promotions, into its type.
+static bool piece_from_letter(char c, enum piece_type *piece)
+{
+    switch (c) {
+        case 'K': *piece = PIECE_KING;   return true;
+        case 'Q': *piece = PIECE_QUEEN;  return true;
+        case 'R': *piece = PIECE_ROOK;   return true;
+        case 'B': *piece = PIECE_BISHOP; return true;
+        case 'N': *piece = PIECE_KNIGHT; return true;
+        default: return false;
+    }
+}
+
+static enum chess_status syntax_error(const char **reason, const char *message)
+{
+    *reason = message;
+    return CHESS_ERROR_SYNTAX;
+}
+
+enum chess_status parse_san(const char *san, size_t length, struct chess_move *move, const char **reason)
 {
     // Reset move fields
     move->capture   = false;
     move->source_x  = -1;
     move->source_y  = -1;
     move->castling  = CASTLE_NONE;
-    move->promotion = PIECE_EMPTY;   // new field for promotion
-
-    char c;
-
-    // Skip leading spaces
-    do {
-        c = getc(stdin);
-    } while (c == ' ');
+    move->promotion = false;
+    move->promotion_piece = PIECE_EMPTY;
+    move->en_passant = false;
 
-    // End of input
-    if (c == '\n' || c == '\r' || c == EOF) {
-        return false;
+    while (length > 0 && is_move_suffix(san[length - 1])) {
+        length--;
     }
+    if (length == 0) {
+        return syntax_error(reason, "empty move");
+    }
+    const char *end = san + length;
 
-    // castle notation handling
-    if (c == 'O') {
-        char dash = getc(stdin);
-        char o2   = getc(stdin);
-        if (dash == '-' && o2 == 'O') {
+    // castle notation handling, written with letters or, by some PGN exporters, with zeros
+    if (san[0] == 'O' || san[0] == '0') {
+        const char *kingside = san[0] == 'O' ? "O-O" : "0-0";
+        const char *queenside = san[0] == 'O' ? "O-O-O" : "0-0-0";
+        if (length == 3 && memcmp(san, kingside, 3) == 0) {
             move->piece_type = PIECE_KING;
-            move->castling   = CASTLE_KINGSIDE;
-
-
-            //continues to scan if queenside is entered
-            char maybe_dash = getc(stdin);
-            if (maybe_dash == '-') {
-                char o3 = getc(stdin);
-                if (o3 == 'O') {
-                    move->castling = CASTLE_QUEENSIDE;
-                } else {
-                    panicf("parse error: invalid castling notation\n");
-                    return false;
-                }
-            } else if (maybe_dash != EOF) {
-                ungetc(maybe_dash, stdin);
-            }
-            return true;
+            move->castling = CASTLE_KINGSIDE;
+            return CHESS_OK;
         }
-        panicf("parse error: invalid castling notation\n");
-        return false;
+        if (length == 5 && memcmp(san, queenside, 5) == 0) {
+            move->piece_type = PIECE_KING;
+            move->castling = CASTLE_QUEENSIDE;
+            return CHESS_OK;
+        }
+        return syntax_error(reason, "invalid castling notation");
     }
-    // First character already read into `c`
-    // c is between 'a' and 'h' → pawn move
 
-    char file_from = c - 'a';
-    char next = getc(stdin);
+    // checks if first letter is lower case indicating a pawn is moving
+    if (is_file(san[0])) {
+        move->piece_type = PIECE_PAWN;
+        const char *c = san + 1;
 
-    struct chess_move *move = ...;
+        // checks if pawn is capturing, e.g. exd5
+        if (c < end && *c == 'x') {
+            move->source_x = san[0] - 'a';
+            move->capture = true;
+            c++;
+            if (c == end || !is_file(*c)) {
+                return syntax_error(reason, "expected target file");
+            }
+            move->target_square_x = *c++ - 'a';
+        } else {
+            move->target_square_x = san[0] - 'a';
+        }
 
-    move->piece_type = PIECE_PAWN;
+        if (c == end || !is_rank(*c)) {
+            return syntax_error(reason, "expected target rank");
+        }
+        move->target_square_y = *c++ - '1';
 
-    // Pawn capture: exd5 or exd6 etc.
-    if (next == 'x') {
-        move->capture = true;
+        // promotion, written e8=Q or e8Q
+        if (c < end && *c == '=') {
+            c++;
+        }
+        if (c < end) {
+            if (!piece_from_letter(*c, &move->promotion_piece) || move->promotion_piece == PIECE_KING) {
+                return syntax_error(reason, "invalid promotion piece");
+            }
+            move->promotion = true;
+            c++;
+        }
+        if (c != end) {
+            return syntax_error(reason, "unexpected character");
+        }
+        return CHESS_OK;
+    }
 
-        char file_to_c = getc(stdin);   // like 'd'
-        char rank_to_c = getc(stdin);   // like '5'
+    // every other pieces notation is handled the same way: the target square is always the last two characters,
+    // optionally preceded by x, with the source file and/or rank before that
+    if (!piece_from_letter(san[0], &move->piece_type)) {
+        return syntax_error(reason, "unknown piece");
+    }
+    if (length < 3 || !is_file(end[-2]) || !is_rank(end[-1])) {
+        return syntax_error(reason, "expected target square");
+    }
+    move->target_square_x = end[-2] - 'a';
+    move->target_square_y = end[-1] - '1';
 
-        move->source_x = file_from;
-        move->target_square_x = file_to_c - 'a';
-        move->target_square_y = (rank_to_c - '1');
+    const char *c = san + 1;
+    const char *target = end - 2;
+    if (c < target && is_file(*c)) {
+        move->source_x = *c++ - 'a';
+    }
+    if (c < target && is_rank(*c)) {
+        move->source_y = *c++ - '1';
+    }
+    if (c < target && *c == 'x') {
+        move->capture = true;
+        c++;
+    }
+    if (c != target) {
+        return syntax_error(reason, "unexpected character");
+    }
+    return CHESS_OK;
+}
 
-        // --- POSSIBLE EN PASSANT ---
-        // If pawn moves diagonally by 1 square, but parser cannot confirm
-        // whether target square contains a piece, mark "maybe en passant"
-        move->en_passant = true;  // board_apply_move() will verify it later
+enum game_format parser_detect_format(const char *buffer, size_t length)
+{
+    size_t i = 0;
+    while (i < length && is_pgn_space(buffer[i])) {
+        i++;
+    }
+    // a move in the line format always starts with a letter, while PGN starts with a tag, a move number or a comment
+    if (i < length && (buffer[i] == '[' || is_digit(buffer[i]) || buffer[i] == '{' || buffer[i] == ';' || buffer[i] == '%')) {
+        return GAME_FORMAT_PGN;
+    }
+    return GAME_FORMAT_LINES;
+}
 
-        return move;
+void parser_init(struct parser *parser, const char *buffer, size_t length, enum game_format format)
+{
+    parser->buffer = buffer;
+    parser->length = length;
+    parser->position = 0;
+    parser->format = format;
+    parser->token = buffer;
+    parser->token_length = 0;
+    parser->in_movetext = false;
+    parser->result = buffer;
+    parser->result_length = 0;
+}
 
-    // checks if first letter is lower case indicating a pawn is moving
-    if (c >= 'a' && c <= 'h') {
-        move->piece_type = PIECE_PAWN;
-        char next_c = getc(stdin);
-
-        // checks if pawn is capturing
-        if (next_c == 'x') {
-            move->source_x = c - 'a';
-            move->capture  = true;
-            c = getc(stdin); // target file
-            next_c = getc(stdin); // target rank
-        }
-
-        move->target_square_x = c - 'a';
-        if (next_c >= '1' && next_c <= '8') {
-            move->target_square_y = next_c - '1';
-
-            //chekcs if = sign is present idicating promotion
-            char promo = getc(stdin);
-            if (promo == '=') {
-                char piece = getc(stdin);
-                switch (piece) {
-                    case 'Q': move->promotion = PIECE_QUEEN;  break;
-                    case 'R': move->promotion = PIECE_ROOK;   break;
-                    case 'B': move->promotion = PIECE_BISHOP; break;
-                    case 'N': move->promotion = PIECE_KNIGHT; break;
-                    default:
-                        panicf("parse error: invalid promotion piece '%c'\n", piece);
-                        return false;
-                }
-            } else if (promo != EOF) {
-                ungetc(promo, stdin);
-            }
+static size_t skip_to_line_end(const char *buffer, size_t length, size_t i)
+{
+    const char *line_end = memchr(buffer + i, '\n', length - i);
+    return line_end ? (size_t) (line_end - buffer) + 1 : length;
+}
 
-            return true;
+// Skips whitespace, {brace} and ;rest-of-line comments, and %escape lines,
+// none of which mean anything between PGN tokens.
+static size_t pgn_skip_space(const char *buffer, size_t length, size_t i)
+{
+    while (i < length) {
+        char c = buffer[i];
+        if (is_pgn_space(c)) {
+            i++;
+        } else if (c == '{') {
+            const char *close = memchr(buffer + i, '}', length - i);
+            i = close ? (size_t) (close - buffer) + 1 : length;
+        } else if (c == ';' || (c == '%' && (i == 0 || buffer[i - 1] == '\n'))) {
+            i = skip_to_line_end(buffer, length, i);
         } else {
-            panicf("parse error at character '%c'\n", next_c);
-            return false;
+            break;
+        }
+    }
+    return i;
+}
+
+// Skips a (variation) starting at buffer[i], including any variations and
+// comments nested in it, so that brackets inside comments are not counted.
+static size_t pgn_skip_variation(const char *buffer, size_t length, size_t i)
+{
+    int depth = 0;
+    while (i < length) {
+        char c = buffer[i];
+        if (c == '{' || c == ';') {
+            i = pgn_skip_space(buffer, length, i);
+            continue;
+        }
+        i++;
+        if (c == '(') {
+            depth++;
+        } else if (c == ')' && --depth == 0) {
+            break;
         }
     }
+    return i;
+}
 
-    // every other pieces notation is handled the same way
-    if (c >= 'A' && c <= 'Z') {
-        switch (c) {
-            case 'K': move->piece_type = PIECE_KING;   break;
-            case 'Q': move->piece_type = PIECE_QUEEN;  break;
-            case 'R': move->piece_type = PIECE_ROOK;   break;
-            case 'B': move->piece_type = PIECE_BISHOP; break;
-            case 'N': move->piece_type = PIECE_KNIGHT; break;
-            default:
-                panicf("parse error: unknown piece '%c'\n", c);
-                return false;
-        }
-
-        c = getc(stdin);
-        char next_c = getc(stdin);
-
-        // checks for disambiguity ie. the a in Qab7
-        if ((c >= 'a' && c <= 'h') && (next_c >= 'a' && next_c <= 'h')) {
-            move->source_x = c - 'a';
-            move->target_square_x = next_c - 'a';
-            char rank = getc(stdin);
-            if (rank >= '1' && rank <= '8') {
-                move->target_square_y = rank - '1';
-                return true;
-            } else {
-                panicf("parse error at character '%c'\n", rank);
-                return false;
+// Skips a [Name "value"] tag pair starting at buffer[i]. A tag that is not
+// closed ends at the end of its line.
+static size_t pgn_skip_tag(const char *buffer, size_t length, size_t i)
+{
+    bool quoted = false;
+    for (i++; i < length && buffer[i] != '\n'; i++) {
+        if (quoted && buffer[i] == '\\') {
+            i++;
+        } else if (buffer[i] == '"') {
+            quoted = !quoted;
+        } else if (!quoted && buffer[i] == ']') {
+            return i + 1;
+        }
+    }
+    return i;
+}
+
+static bool token_equals(const char *token, size_t length, const char *text)
+{
+    return length == strlen(text) && memcmp(token, text, length) == 0;
+}
+
+// Finds the next move of the current PGN game, skipping everything that is
+// not one, and leaves it in parser->token. Returns false at the end of the
+// game: after its result, before the tags of the next game, or at the end of
+// the input.
+static bool pgn_next_token(struct parser *parser)
+{
+    const char *buffer = parser->buffer;
+    const size_t length = parser->length;
+    size_t i = parser->position;
+
+    for (;;) {
+        i = pgn_skip_space(buffer, length, i);
+        if (i == length) {
+            break;
+        }
+
+        char c = buffer[i];
+        if (c == '[') {
+            // tags before the movetext belong to this game, tags after it to the next
+            if (parser->in_movetext) {
+                break;
             }
+            i = pgn_skip_tag(buffer, length, i);
+            continue;
+        }
+        if (c == '(') {
+            i = pgn_skip_variation(buffer, length, i);
+            continue;
         }
+        if (c == ')') {
+            i++;
+            continue;
+        }
+        parser->in_movetext = true;
 
-        // Origin + capture like "Nbd2" or "R1xd4"
-        if (next_c == 'x' && ((c >= 'a' && c <= 'h') || (c >= '1' && c <= '8'))) {
-            move->capture = true;
-            if (c >= 'a' && c <= 'h') {
-                move->source_x = c - 'a';
-            } else {
-                move->source_y = c - '1';
+        // move numbers, "12." for white or "12..." for black, may run straight into the move
+        if (is_digit(c)) {
+            size_t digits = i;
+            while (digits < length && is_digit(buffer[digits])) {
+                digits++;
+            }
+            if (digits < length && buffer[digits] == '.') {
+                i = digits;
+                while (i < length && buffer[i] == '.') {
+                    i++;
+                }
+                continue;
             }
-            c      = getc(stdin);
-            next_c = getc(stdin);
         }
 
-        // Simple capture like "Qxd5"
-        if (c == 'x') {
-            move->capture = true;
-            c      = next_c;
-            next_c = getc(stdin);
-        }
-
-        if (c >= 'a' && c <= 'h') {
-            move->target_square_x = c - 'a';
-            if (next_c >= '1' && next_c <= '8') {
-                move->target_square_y = next_c - '1';
-                return true;
-            } else {
-                panicf("parse error at character '%c'\n", next_c);
-                return false;
+        // numeric annotation glyphs such as $1
+        if (c == '$') {
+            for (i++; i < length && is_digit(buffer[i]); i++) {
             }
-        } else {
-            panicf("parse error at character '%c'\n", c);
+            continue;
+        }
+
+        size_t start = i;
+        while (i < length && !is_pgn_delimiter(buffer[i])) {
+            i++;
+        }
+        const char *token = buffer + start;
+        size_t token_length = i - start;
+
+        // annotations written apart from their move, such as "!?"
+        if (c == '!' || c == '?') {
+            continue;
+        }
+        if (token_equals(token, token_length, "1-0") || token_equals(token, token_length, "0-1") ||
+            token_equals(token, token_length, "1/2-1/2") || token_equals(token, token_length, "*")) {
+            parser->position = i;
+            parser->result = token;
+            parser->result_length = token_length;
+            parser->in_movetext = false;
             return false;
         }
+
+        parser->position = i;
+        parser->token = token;
+        parser->token_length = token_length;
+        return true;
     }
 
-    panicf("parse error: unexpected character '%c'\n", c);
+    parser->position = i;
+    parser->result_length = 0;
+    parser->in_movetext = false;
     return false;
-}
\ No newline at end of file
+}
+
+bool parser_next_tag(struct parser *parser, struct pgn_tag *tag)
+{
+    if (parser->format != GAME_FORMAT_PGN || parser->in_movetext) {
+        return false;
+    }
+    const char *buffer = parser->buffer;
+    const size_t length = parser->length;
+    size_t i = pgn_skip_space(buffer, length, parser->position);
+    if (i == length || buffer[i] != '[') {
+        return false;
+    }
+
+    size_t end = pgn_skip_tag(buffer, length, i);
+    parser->position = end;
+
+    // [Name "value"], where the value may contain escaped quotes
+    i++;
+    while (i < end && is_space(buffer[i])) {
+        i++;
+    }
+    tag->name = buffer + i;
+    while (i < end && !is_space(buffer[i]) && buffer[i] != '"' && buffer[i] != ']') {
+        i++;
+    }
+    tag->name_length = (size_t) (buffer + i - tag->name);
+    while (i < end && buffer[i] != '"') {
+        i++;
+    }
+    size_t value = i < end ? i + 1 : i;
+    for (i = value; i < end && buffer[i] != '"'; i++) {
+        if (buffer[i] == '\\') {
+            i++;
+        }
+    }
+    tag->value = buffer + value;
+    tag->value_length = (i < end ? i : end) - value;
+    return true;
+}
+
+static bool lines_next_move(struct parser *parser)
+{
+    const char *buffer = parser->buffer;
+    const size_t length = parser->length;
+    size_t i = parser->position;
+
+    // Skip leading spaces
+    while (i < length && is_space(buffer[i])) {
+        i++;
+    }
+
+    // End of the game, treating a CRLF line ending as a single end of line
+    if (i == length) {
+        parser->position = i;
+        return false;
+    }
+    if (buffer[i] == '\r' || buffer[i] == '\n') {
+        if (buffer[i] == '\r' && i + 1 < length && buffer[i + 1] == '\n') {
+            i++;
+        }
+        parser->position = i + 1;
+        return false;
+    }
+
+    // the move runs up to the next space or line break
+    size_t start = i;
+    while (i < length && !is_space(buffer[i]) && buffer[i] != '\n' && buffer[i] != '\r') {
+        i++;
+    }
+    parser->position = i;
+    parser->token = buffer + start;
+    parser->token_length = i - start;
+    return true;
+}
+
+bool parser_next_move(struct parser *parser, struct chess_move *move, struct chess_error *error)
+{
+    error->status = CHESS_OK;
+    bool found = parser->format == GAME_FORMAT_PGN ? pgn_next_token(parser) : lines_next_move(parser);
+    if (!found) {
+        return false;
+    }
+
+    if (parse_san(parser->token, parser->token_length, move, &error->reason) != CHESS_OK) {
+        error->status = CHESS_ERROR_SYNTAX;
+        error_set_san(error, parser->token, parser->token_length);
+        return false;
+    }
+    return true;
+}
+
+void parser_skip_game(struct parser *parser)
+{
+    if (parser->format == GAME_FORMAT_PGN) {
+        while (pgn_next_token(parser)) {
+        }
+        return;
+    }
+    parser->position = skip_to_line_end(parser->buffer, parser->length, parser->position);
+}
+
+enum recorded_result parser_recorded_result(const struct parser *parser)
+{
+    if (token_equals(parser->result, parser->result_length, "1-0")) {
+        return RECORDED_WHITE_WINS;
+    }
+    if (token_equals(parser->result, parser->result_length, "0-1")) {
+        return RECORDED_BLACK_WINS;
+    }
+    if (token_equals(parser->result, parser->result_length, "1/2-1/2")) {
+        return RECORDED_DRAW;
+    }
+    return RECORDED_NONE;
+}
@@ -2,12 +2,93 @@
 #define APSC143__PARSER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "board.h"
 
-// Read a move from standard input. The initial contents of *move are ignored
-// and can be uninitialized. If there is a syntax error or the end of the input
-// is reached, returns false; the contents of *move in such a case are
-// unspecified.
-bool parse_move(struct chess_move *move);
+// How games are laid out in the input.
+enum game_format
+{
+    GAME_FORMAT_LINES, // bare moves separated by spaces, one game per line
+    GAME_FORMAT_PGN    // Portable Game Notation: tag pairs, then numbered movetext ending in a result
+};
+
+// A cursor over a buffer of games. The buffer is never copied or modified, so
+// it can be a memory-mapped file, and it does not need to be NUL-terminated.
+struct parser
+{
+    const char *buffer;
+    size_t length;
+    size_t position;
+    enum game_format format;
+
+    // The move most recently returned by parser_next_move, pointing into the
+    // buffer.
+    const char *token;
+    size_t token_length;
+
+    // PGN only: set once the current game's movetext has begun, after which a
+    // tag pair starts the next game.
+    bool in_movetext;
+
+    // PGN only: the result token that ended the last game, e.g. "1-0", pointing
+    // into the buffer. Empty if the game ended without one.
+    const char *result;
+    size_t result_length;
+};
+
+// The result a game records for itself, from its PGN result token. It can
+// differ from what the final position shows, since most games end by
+// resignation, on time or by agreement.
+enum recorded_result
+{
+    RECORDED_NONE, // no result token, or "*"
+    RECORDED_WHITE_WINS,
+    RECORDED_BLACK_WINS,
+    RECORDED_DRAW
+};
+
+// A PGN tag pair such as [White "Carlsen, Magnus"], pointing into the buffer.
+// The value is exactly as written, so escaped quotes are left as \".
+struct pgn_tag
+{
+    const char *name;
+    size_t name_length;
+    const char *value;
+    size_t value_length;
+};
+
+// Guesses the format of the games in the buffer: PGN if it starts with a tag
+// pair or a move number, otherwise one game per line.
+enum game_format parser_detect_format(const char *buffer, size_t length);
+
+// Starts reading at the beginning of the buffer.
+void parser_init(struct parser *parser, const char *buffer, size_t length, enum game_format format);
+
+// Reads the next tag pair of the current PGN game into *tag. Returns false
+// once the movetext begins, or always for line input. Tags do not have to be
+// read: parser_next_move skips any that are left.
+bool parser_next_tag(struct parser *parser, struct pgn_tag *tag);
+
+// Reads the next move of the current game. The initial contents of *move are
+// ignored and can be uninitialized. Returns true if a move was read. Returns
+// false at the end of the game, which is consumed, or at the end of the input;
+// error->status is then CHESS_OK. A game ends at the end of its line, or for
+// PGN at its result token or at the tags of the next game. PGN move numbers,
+// comments, variations and annotations are skipped. On a syntax error returns
+// false with error->status, error->reason and error->san describing the
+// problem, and the cursor left inside the game. error->move_index is not
+// touched.
+bool parser_next_move(struct parser *parser, struct chess_move *move, struct chess_error *error);
+
+// Discards the rest of the current game, e.g. after an error.
+void parser_skip_game(struct parser *parser);
+
+// Gets the result recorded by the result token that ended the last game.
+enum recorded_result parser_recorded_result(const struct parser *parser);
+
+// Parses a single move in standard algebraic notation, e.g. "Nbxd7" or
+// "e8=Q". Check and mate marks and move annotations such as "+", "#" or "!?"
+// at the end are ignored. The token does not need to be NUL-terminated.
+enum chess_status parse_san(const char *san, size_t length, struct chess_move *move, const char **reason);
 
 #endif
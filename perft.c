@@ -0,0 +1,268 @@
+// chess-perft: counts the leaf nodes of the legal move tree to a fixed depth.
+// The counts are compared against published values to check the move
+// generator, and the nodes per second give a single speed figure for the
+// board code.
+//
+// Usage:
+//   chess-perft <fen> <depth>           node counts for depths 1..depth
+//   chess-perft --divide <fen> <depth>  also the count below each root move
+//   chess-perft --suite [max-depth]     run the reference positions and check
+//                                       their incremental keys, check that
+//                                       impossible ones are rejected and that
+//                                       searches find known best moves
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "board.h"
+#include "movegen.h"
+#include "search.h"
+#include "timer.h"
+
+// How deep chess-perft --suite checks the incremental keys of each reference
+// position.
+#define HASH_CHECK_DEPTH 3
+
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+struct perft_position
+{
+    const char *name;
+    const char *fen;
+    int depths;
+    long long nodes[6]; // expected node count at depth 1, 2, ...
+};
+
+// The standard reference positions from the Chess Programming Wiki "Perft
+// Results" page, which between them cover castling, en passant, promotion and
+// discovered checks.
+static const struct perft_position reference_positions[] = {
+    {"initial position", START_FEN,
+     6, {20, 400, 8902, 197281, 4865609, 119060324}},
+    {"kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+     5, {48, 2039, 97862, 4085603, 193690690}},
+    {"position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+     6, {14, 191, 2812, 43238, 674624, 11030083}},
+    {"position 4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+     5, {6, 264, 9467, 422333, 15833292}},
+    {"position 5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+     5, {44, 1486, 62379, 2103487, 89941194}},
+    {"position 6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+     5, {46, 2079, 89890, 3894594, 164075551}},
+};
+
+// Positions board_from_fen must reject. The first has 261 moves, more than a
+// move list holds.
+static const char *const rejected_positions[] = {
+    "QQQQQQQB/Q6Q/Q6Q/Q6Q/Q6Q/QQ5Q/pp3Q1Q/kBQQQKQQ w - - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/P7/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/N7/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNQ w Qkq - 0 1",
+    "rnbqkbnP/pppppppp/8/8/8/8/PPPPPPP1/RNBQKBNR b KQq - 0 1",
+    "rnbqkbnr/pppp1ppp/8/4p3/8/8/PPPPPPPP/RNBQKBNR w KQkq e3 0 2",
+};
+
+// Positions with one best move that board_search must find at the given depth.
+struct search_position
+{
+    const char *fen;
+    int depth;
+    const char *best_move; // in coordinate notation
+};
+
+static const struct search_position search_positions[] = {
+    // mate on the hundredth half-move wins rather than being drawn by the fifty-move rule
+    {"6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 99 60", 3, "d1d8"},
+};
+
+static long long perft(struct chess_board *board, int depth)
+{
+    struct chess_move_list moves;
+    int count = board_generate_moves(board, &moves);
+
+    // the moves at the last ply are counted without being played
+    if (depth == 1) {
+        return count;
+    }
+
+    long long nodes = 0;
+    struct chess_move move;
+    struct board_undo undo;
+    for (int i = 0; i < count; i++) {
+        move_unpack(board, moves.moves[i], &move);
+        board_make_move(board, &move, &undo);
+        nodes += perft(board, depth - 1);
+        board_unmake_move(board, &move, &undo);
+    }
+    return nodes;
+}
+
+// Plays every move sequence to the given depth, as perft does, and counts the
+// positions after a move or its undo whose incremental key differs from the
+// one computed from scratch.
+static long long hash_mismatches(struct chess_board *board, int depth)
+{
+    struct chess_move_list moves;
+    int count = board_generate_moves(board, &moves);
+
+    long long mismatches = 0;
+    struct chess_move move;
+    struct board_undo undo;
+    for (int i = 0; i < count; i++) {
+        move_unpack(board, moves.moves[i], &move);
+        board_make_move(board, &move, &undo);
+        mismatches += board_hash(board) != board_compute_hash(board);
+        if (depth > 1) {
+            mismatches += hash_mismatches(board, depth - 1);
+        }
+        board_unmake_move(board, &move, &undo);
+        mismatches += board_hash(board) != board_compute_hash(board);
+    }
+    return mismatches;
+}
+
+static long long divide(struct chess_board *board, int depth)
+{
+    struct chess_move_list moves;
+    int count = board_generate_moves(board, &moves);
+
+    long long total = 0;
+    struct chess_move move;
+    struct board_undo undo;
+    for (int i = 0; i < count; i++) {
+        move_unpack(board, moves.moves[i], &move);
+        board_make_move(board, &move, &undo);
+        long long nodes = depth > 1 ? perft(board, depth - 1) : 1;
+        board_unmake_move(board, &move, &undo);
+
+        char name[6];
+        move_to_coordinates(moves.moves[i], name);
+        printf("%s: %lld\n", name, nodes);
+        total += nodes;
+    }
+    printf("\n");
+    return total;
+}
+
+// Says which slider attack lookup the figures below were measured with.
+static void print_header(void)
+{
+    printf("slider attacks: %s\n\n", bitboard_uses_pext() ? "pext" : "magic multiplication");
+}
+
+static void print_depth(int depth, long long nodes, double seconds)
+{
+    double nps = seconds > 0 ? (double) nodes / seconds : 0;
+    printf("depth %d: %12lld nodes  %8.3f s  %12.0f nodes/s\n", depth, nodes, seconds, nps);
+}
+
+static int run_fen(const char *fen, int max_depth, bool show_divide)
+{
+    struct chess_board board;
+    if (!board_from_fen(&board, fen)) {
+        fprintf(stderr, "invalid FEN: %s\n", fen);
+        return 1;
+    }
+    print_header();
+
+    for (int depth = 1; depth <= max_depth; depth++) {
+        double start = timer_seconds();
+        long long nodes = (show_divide && depth == max_depth) ? divide(&board, depth) : perft(&board, depth);
+        print_depth(depth, nodes, timer_seconds() - start);
+    }
+    return 0;
+}
+
+static int run_suite(int max_depth)
+{
+    long long total_nodes = 0;
+    double total_seconds = 0;
+    int failures = 0;
+    print_header();
+
+    for (size_t i = 0; i < sizeof(reference_positions) / sizeof(reference_positions[0]); i++) {
+        const struct perft_position *position = &reference_positions[i];
+        struct chess_board board;
+        board_from_fen(&board, position->fen);
+
+        printf("%s\n", position->name);
+        for (int depth = 1; depth <= position->depths && depth <= max_depth; depth++) {
+            double start = timer_seconds();
+            long long nodes = perft(&board, depth);
+            double seconds = timer_seconds() - start;
+            print_depth(depth, nodes, seconds);
+
+            if (nodes != position->nodes[depth - 1]) {
+                printf("  FAILED: expected %lld\n", position->nodes[depth - 1]);
+                failures++;
+            }
+            total_nodes += nodes;
+            total_seconds += seconds;
+        }
+
+        // checked apart from the timed runs, and less deep, since computing every key from scratch is slow
+        long long mismatches = hash_mismatches(&board, HASH_CHECK_DEPTH < max_depth ? HASH_CHECK_DEPTH : max_depth);
+        if (mismatches != 0) {
+            printf("  FAILED: %lld incremental keys differ from the computed ones\n", mismatches);
+            failures++;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(rejected_positions) / sizeof(rejected_positions[0]); i++) {
+        struct chess_board board;
+        if (board_from_fen(&board, rejected_positions[i])) {
+            printf("FAILED: accepted %s\n", rejected_positions[i]);
+            failures++;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(search_positions) / sizeof(search_positions[0]); i++) {
+        const struct search_position *position = &search_positions[i];
+        struct chess_board board;
+        struct search_limits limits = {position->depth, 0, 0};
+        struct search_result result;
+        char name[6];
+        board_from_fen(&board, position->fen);
+        board_search(&board, &limits, &result);
+        move_to_coordinates(result.best_move, name);
+        if (strcmp(name, position->best_move) != 0) {
+            printf("FAILED: searched %s to %s, expected %s\n", position->fen, name, position->best_move);
+            failures++;
+        }
+    }
+
+    printf("\ntotal: %lld nodes  %.3f s  %.0f nodes/s\n", total_nodes, total_seconds,
+           total_seconds > 0 ? (double) total_nodes / total_seconds : 0);
+    printf("%s\n", failures == 0 ? "all counts match" : "MISMATCHED COUNTS");
+    return failures == 0 ? 0 : 1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: chess-perft [--divide] <fen> <depth>\n"
+            "       chess-perft --suite [max-depth]\n");
+}
+
+int main(int argc, char **argv)
+{
+    board_init_tables();
+
+    if (argc >= 2 && strcmp(argv[1], "--suite") == 0) {
+        return run_suite(argc >= 3 ? atoi(argv[2]) : 5);
+    }
+
+    bool show_divide = argc >= 2 && strcmp(argv[1], "--divide") == 0;
+    int first = show_divide ? 2 : 1;
+    if (argc != first + 2) {
+        usage();
+        return 2;
+    }
+
+    int depth = atoi(argv[first + 1]);
+    if (depth < 1) {
+        usage();
+        return 2;
+    }
+    return run_fen(argv[first], depth, show_divide);
+}
@@ -0,0 +1,381 @@
+#define _POSIX_C_SOURCE 200112L
+#include "position_index.h"
+#include <stdlib.h>
+#include <string.h>
+#include "array.h"
+
+// Each thread sorts the entries of its games in chunks of at most this many,
+// and spills every chunk to a temporary file as a sorted run. The runs are
+// merged into the index, so memory stays bounded however many games there are.
+#define RUN_ENTRIES (1 << 20)
+
+// Entries read from a run at a time while merging.
+#define MERGE_ENTRIES 4096
+
+#ifdef _WIN32
+#define seek_to(stream, offset) _fseeki64(stream, (long long) (offset), SEEK_SET)
+#else
+#define seek_to(stream, offset) fseeko(stream, (off_t) (offset), SEEK_SET)
+#endif
+
+// Entries recorded but not yet spilled, grown by doubling.
+struct entry_buffer
+{
+    struct position_entry *entries;
+    size_t count;
+    size_t capacity;
+};
+
+static bool entry_buffer_push(struct entry_buffer *buffer, uint64_t hash, size_t game, int ply)
+{
+    struct position_entry *entries = array_reserve(buffer->entries, &buffer->capacity, buffer->count,
+                                                   sizeof(struct position_entry));
+    if (entries == NULL) {
+        return false;
+    }
+    buffer->entries = entries;
+    struct position_entry *entry = &entries[buffer->count++];
+    entry->hash = hash;
+    entry->game = (uint32_t) game;
+    entry->ply = (uint32_t) ply;
+    return true;
+}
+
+// Sorts the entries by key with a least significant digit radix sort, 16 bits
+// a pass. Each pass is stable, so entries with the same key stay in the order
+// they were recorded in: by game, then by ply. Returns false if memory runs
+// out.
+static bool sort_entries(struct entry_buffer *buffer)
+{
+    struct position_entry *from = buffer->entries;
+    struct position_entry *to = malloc((buffer->count ? buffer->count : 1) * sizeof(struct position_entry));
+    size_t *counts = malloc(65536 * sizeof(size_t));
+    if (to == NULL || counts == NULL) {
+        free(to);
+        free(counts);
+        return false;
+    }
+
+    for (int shift = 0; shift < 64; shift += 16) {
+        memset(counts, 0, 65536 * sizeof(size_t));
+        for (size_t i = 0; i < buffer->count; i++) {
+            counts[(from[i].hash >> shift) & 0xffff]++;
+        }
+        size_t offset = 0;
+        for (size_t digit = 0; digit < 65536; digit++) {
+            size_t count = counts[digit];
+            counts[digit] = offset;
+            offset += count;
+        }
+        for (size_t i = 0; i < buffer->count; i++) {
+            to[counts[(from[i].hash >> shift) & 0xffff]++] = from[i];
+        }
+        struct position_entry *swap = from;
+        from = to;
+        to = swap;
+    }
+
+    // an even number of passes leaves the sorted entries back in the original array
+    free(to);
+    free(counts);
+    buffer->entries = from;
+    return true;
+}
+
+// A sorted run of entries in a thread's spill file.
+struct index_run
+{
+    FILE *file;
+    uint64_t offset; // in bytes
+    size_t count;
+};
+
+// A thread's share of the work: the entries of its games not yet spilled, and
+// the runs it has spilled. A thread claims ranges in order, so its entries are
+// recorded by game, then by ply.
+struct index_worker
+{
+    struct entry_buffer buffer;
+    FILE *spill; // opened on the first spill
+    uint64_t spilled_bytes;
+    struct index_run *runs;
+    size_t run_count;
+    size_t run_capacity;
+    size_t game;
+    long error_counts[CHESS_STATUS_COUNT];
+    bool ok;
+};
+
+// Sorts the worker's entries and appends them to its spill file as a run.
+static bool spill_run(struct index_worker *worker)
+{
+    struct entry_buffer *buffer = &worker->buffer;
+    if (buffer->count == 0) {
+        return true;
+    }
+    if (worker->spill == NULL && (worker->spill = tmpfile()) == NULL) {
+        return false;
+    }
+    struct index_run *runs = array_reserve(worker->runs, &worker->run_capacity, worker->run_count,
+                                           sizeof(struct index_run));
+    if (runs == NULL || !sort_entries(buffer) ||
+        fwrite(buffer->entries, sizeof(struct position_entry), buffer->count, worker->spill) != buffer->count) {
+        return false;
+    }
+    worker->runs = runs;
+    runs[worker->run_count++] = (struct index_run) {worker->spill, worker->spilled_bytes, buffer->count};
+    worker->spilled_bytes += (uint64_t) buffer->count * sizeof(struct position_entry);
+    buffer->count = 0;
+    return true;
+}
+
+static void record_position(void *context, const struct replay_step *step)
+{
+    struct index_worker *worker = context;
+    if (worker->ok && worker->buffer.count == RUN_ENTRIES) {
+        worker->ok = spill_run(worker);
+    }
+    worker->ok = worker->ok && entry_buffer_push(&worker->buffer, board_hash(step->board), worker->game, step->ply);
+}
+
+struct index_batch
+{
+    const struct replay_source *source;
+    struct index_worker *workers;
+};
+
+// Replays a range of games, recording every position each reaches.
+static void index_range(void *context, int thread, size_t range, size_t first, size_t end)
+{
+    const struct index_batch *batch = context;
+    struct index_worker *worker = &batch->workers[thread];
+    struct replay_visitor visitor = {record_position, NULL, worker};
+    struct chess_board board;
+    struct chess_error error;
+    (void) range;
+
+    for (worker->game = first; worker->game < end && worker->ok; worker->game++) {
+        int move_count;
+        enum chess_status status = replay_source_game(batch->source, worker->game, &board, OUTPUT_QUIET, NULL,
+                                                      &visitor, &move_count, &error);
+        worker->error_counts[status]++;
+    }
+}
+
+// Reads a run back a block at a time while merging.
+struct run_reader
+{
+    struct index_run run;
+    struct position_entry *entries;
+    size_t at;
+    size_t filled;
+};
+
+// Makes the reader's next entry available. Returns false at the end of the
+// run or if reading fails, telling which by *ok.
+static bool reader_fill(struct run_reader *reader, bool *ok)
+{
+    if (reader->at < reader->filled) {
+        return true;
+    }
+    if (reader->run.count == 0) {
+        return false;
+    }
+    size_t count = reader->run.count < MERGE_ENTRIES ? reader->run.count : MERGE_ENTRIES;
+    if (seek_to(reader->run.file, reader->run.offset) != 0 ||
+        fread(reader->entries, sizeof(struct position_entry), count, reader->run.file) != count) {
+        *ok = false;
+        return false;
+    }
+    reader->run.offset += (uint64_t) count * sizeof(struct position_entry);
+    reader->run.count -= count;
+    reader->at = 0;
+    reader->filled = count;
+    return true;
+}
+
+// Orders entries by key, then by game, then by ply, which is the order of the
+// index.
+static bool entry_before(const struct position_entry *x, const struct position_entry *y)
+{
+    if (x->hash != y->hash) {
+        return x->hash < y->hash;
+    }
+    if (x->game != y->game) {
+        return x->game < y->game;
+    }
+    return x->ply < y->ply;
+}
+
+static bool reader_before(const struct run_reader *x, const struct run_reader *y)
+{
+    return entry_before(&x->entries[x->at], &y->entries[y->at]);
+}
+
+// Restores the heap order of the readers below heap[i].
+static void sift_down(struct run_reader **heap, size_t count, size_t i)
+{
+    for (;;) {
+        size_t least = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < count && reader_before(heap[left], heap[least])) {
+            least = left;
+        }
+        if (right < count && reader_before(heap[right], heap[least])) {
+            least = right;
+        }
+        if (least == i) {
+            return;
+        }
+        struct run_reader *swap = heap[i];
+        heap[i] = heap[least];
+        heap[least] = swap;
+        i = least;
+    }
+}
+
+// Merges the runs into one sorted stream of entries and writes it out.
+static bool merge_runs(FILE *stream, const struct index_run *runs, size_t run_count)
+{
+    struct run_reader *readers = calloc(run_count ? run_count : 1, sizeof(struct run_reader));
+    struct run_reader **heap = malloc((run_count ? run_count : 1) * sizeof(struct run_reader *));
+    struct position_entry *blocks = malloc((run_count + 1) * MERGE_ENTRIES * sizeof(struct position_entry));
+    struct position_entry *out = blocks + run_count * MERGE_ENTRIES;
+    bool ok = readers != NULL && heap != NULL && blocks != NULL;
+
+    size_t heap_count = 0;
+    for (size_t i = 0; ok && i < run_count; i++) {
+        readers[i].run = runs[i];
+        readers[i].entries = blocks + i * MERGE_ENTRIES;
+        if (reader_fill(&readers[i], &ok)) {
+            heap[heap_count++] = &readers[i];
+        }
+    }
+    for (size_t i = heap_count / 2; i-- > 0;) {
+        sift_down(heap, heap_count, i);
+    }
+
+    size_t out_count = 0;
+    while (ok && heap_count > 0) {
+        struct run_reader *reader = heap[0];
+        out[out_count++] = reader->entries[reader->at++];
+        if (out_count == MERGE_ENTRIES) {
+            ok = fwrite(out, sizeof(struct position_entry), out_count, stream) == out_count;
+            out_count = 0;
+        }
+        if (!reader_fill(reader, &ok)) {
+            heap[0] = heap[--heap_count];
+        }
+        sift_down(heap, heap_count, 0);
+    }
+    ok = ok && fwrite(out, sizeof(struct position_entry), out_count, stream) == out_count;
+
+    free(readers);
+    free(heap);
+    free(blocks);
+    return ok;
+}
+
+bool position_index_write(FILE *stream, const struct replay_source *source, int threads,
+                          long error_counts[CHESS_STATUS_COUNT])
+{
+    if (threads < 1) {
+        threads = 1;
+    }
+    struct index_batch batch;
+    batch.source = source;
+    batch.workers = calloc((size_t) threads, sizeof(struct index_worker));
+    if (batch.workers == NULL) {
+        return false;
+    }
+    for (int i = 0; i < threads; i++) {
+        batch.workers[i].ok = true;
+    }
+
+    size_t game_count = replay_source_count(source);
+    replay_pool_run(game_count, threads, index_range, NULL, &batch);
+
+    // spill what each thread has left, and gather the runs of all of them
+    bool ok = true;
+    struct index_run *runs = NULL;
+    size_t run_count = 0;
+    size_t run_capacity = 0;
+    uint64_t entry_count = 0;
+    for (int status = 0; status < CHESS_STATUS_COUNT; status++) {
+        error_counts[status] = 0;
+    }
+    for (int i = 0; i < threads; i++) {
+        struct index_worker *worker = &batch.workers[i];
+        ok = ok && worker->ok && spill_run(worker);
+        for (int status = 0; status < CHESS_STATUS_COUNT; status++) {
+            error_counts[status] += worker->error_counts[status];
+        }
+        free(worker->buffer.entries);
+        for (size_t run = 0; ok && run < worker->run_count; run++) {
+            struct index_run *grown = array_reserve(runs, &run_capacity, run_count, sizeof(struct index_run));
+            ok = grown != NULL;
+            if (ok) {
+                runs = grown;
+                runs[run_count++] = worker->runs[run];
+                entry_count += worker->runs[run].count;
+            }
+        }
+        ok = ok && (worker->spill == NULL || fflush(worker->spill) == 0);
+    }
+
+    if (ok) {
+        struct position_index_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, POSITION_INDEX_MAGIC, sizeof(header.magic));
+        header.version = POSITION_INDEX_VERSION;
+        header.entry_count = entry_count;
+        header.game_count = game_count;
+        ok = fwrite(&header, sizeof(header), 1, stream) == 1 && merge_runs(stream, runs, run_count) &&
+             fflush(stream) == 0;
+    }
+
+    // closing a temporary file deletes it
+    for (int i = 0; i < threads; i++) {
+        if (batch.workers[i].spill != NULL) {
+            fclose(batch.workers[i].spill);
+        }
+        free(batch.workers[i].runs);
+    }
+    free(runs);
+    free(batch.workers);
+    return ok;
+}
+
+bool position_index_detect(const struct input *input)
+{
+    return input->length >= sizeof(struct position_index_header) &&
+           memcmp(input->data, POSITION_INDEX_MAGIC, sizeof(((struct position_index_header *) 0)->magic)) == 0;
+}
+
+bool position_index_open(const struct input *input, struct position_index *index)
+{
+    if (!position_index_detect(input)) {
+        return false;
+    }
+    const struct position_index_header *header = (const struct position_index_header *) input->data;
+    size_t available = input->length - sizeof(struct position_index_header);
+    if (header->version != POSITION_INDEX_VERSION ||
+        header->entry_count > available / sizeof(struct position_entry)) {
+        return false;
+    }
+    index->entries = (const struct position_entry *) (header + 1);
+    index->entry_count = header->entry_count;
+    index->game_count = header->game_count;
+    return true;
+}
+
+size_t position_index_find(const struct position_index *index, uint64_t hash, const struct position_entry **first)
+{
+    size_t size = sizeof(struct position_entry);
+    size_t begin = array_lower_bound(index->entries, index->entry_count, size, hash);
+    size_t end = hash == UINT64_MAX ? index->entry_count
+                                    : array_lower_bound(index->entries, index->entry_count, size, hash + 1);
+    *first = index->entries + begin;
+    return end - begin;
+}
@@ -0,0 +1,75 @@
+#ifndef APSC143__POSITION_INDEX_H
+#define APSC143__POSITION_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "archive.h"
+#include "board.h"
+#include "input.h"
+#include "replay.h"
+#include "status.h"
+
+// A file listing every position reached in a set of games, sorted by position
+// key, so that the games that reached a position are found by binary search
+// instead of by replaying them all. The layout is:
+//
+//   struct position_index_header
+//   struct position_entry   entries[entry_count]
+//
+// Like an archive, it is stored in the byte order of the machine that wrote
+// it. Positions are matched by key alone, so a lookup can in principle return
+// a game that reached a different position with the same 64-bit key.
+
+#define POSITION_INDEX_MAGIC "CHESSPIX"
+#define POSITION_INDEX_VERSION 1
+
+struct position_index_header
+{
+    char magic[8]; // POSITION_INDEX_MAGIC, without a NUL
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t entry_count;
+    uint64_t game_count;
+};
+
+// One position of one game. Entries with the same key are in game order, and
+// by ply within a game.
+struct position_entry
+{
+    uint64_t hash;
+    uint32_t game; // counted from 0, in input order
+    uint32_t ply;  // moves played before the position, 0 for the start
+};
+
+// An index read in place from an input, which must outlive it.
+struct position_index
+{
+    const struct position_entry *entries;
+    size_t entry_count;
+    size_t game_count;
+};
+
+// Replays every game of the source on the given number of threads and writes
+// the index of the positions reached to the stream. The entries are sorted in
+// bounded chunks spilled to temporary files and merged from there, so memory
+// does not grow with the number of games. error_counts[status] is set to the
+// number of games that ended with each status; a game with a bad move
+// contributes the positions before it. Returns false if writing fails,
+// including to the temporary files, or memory runs out.
+bool position_index_write(FILE *stream, const struct replay_source *source, int threads,
+                          long error_counts[CHESS_STATUS_COUNT]);
+
+// Checks if the input starts like a position index.
+bool position_index_detect(const struct input *input);
+
+// Reads the position index held in the input. Returns false if it is not an
+// index or is truncated.
+bool position_index_open(const struct input *input, struct position_index *index);
+
+// Finds the positions with the given key. Sets *first to the first of them and
+// returns how many there are.
+size_t position_index_find(const struct position_index *index, uint64_t hash, const struct position_entry **first);
+
+#endif
@@ -0,0 +1,424 @@
+#include "replay.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "panic.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Games are handed to threads in ranges of this many, which keeps the cost of
+// claiming work and of finishing each range small next to replaying it.
+#define GAMES_PER_RANGE 512
+
+// Shows the visitor a position of the game.
+static void visit(const struct replay_visitor *visitor, const struct chess_board *board, int ply, packed_move move,
+                  uint64_t previous_hash)
+{
+    struct replay_step step = {board, ply, move, previous_hash};
+    visitor->visit(visitor->context, &step);
+}
+
+// Sets the board to a copy of *start, or to the initial position if start is
+// NULL.
+static void copy_start(const struct chess_board *start, struct chess_board *board)
+{
+    if (start != NULL)
+    {
+        board_copy(board, start);
+    }
+    else
+    {
+        board_initialize(board);
+    }
+}
+
+// Reads the tags of the next game and sets up the position it starts from: the
+// one its FEN tag gives if it has one, otherwise the one copy_start gives.
+// Returns false if the FEN tag cannot be used, leaving the board as copy_start
+// sets it.
+static bool setup_start(struct parser *parser, const struct chess_board *start, struct chess_board *board)
+{
+    struct pgn_tag tag;
+    bool tagged = false;
+
+    while (parser_next_tag(parser, &tag))
+    {
+        if (tag.name_length == 3 && memcmp(tag.name, "FEN", 3) == 0)
+        {
+            char fen[BOARD_FEN_MAX];
+            bool fits = tag.value_length < sizeof(fen);
+            if (fits)
+            {
+                memcpy(fen, tag.value, tag.value_length);
+                fen[tag.value_length] = '\0';
+            }
+            if (!fits || !board_from_fen(board, fen))
+            {
+                copy_start(start, board);
+                return false;
+            }
+            tagged = true;
+        }
+    }
+
+    if (!tagged)
+    {
+        copy_start(start, board);
+    }
+    return true;
+}
+
+enum chess_status replay_game(struct parser *parser, const struct chess_board *start, struct chess_board *board,
+                              enum output_policy policy, struct output_buffer *out,
+                              const struct replay_visitor *visitor, int *move_count, struct chess_error *error)
+{
+    struct chess_move move;
+
+    *move_count = 0;
+    if (!setup_start(parser, start, board))
+    {
+        error->status = CHESS_ERROR_START;
+        error->reason = "bad FEN tag";
+        error->move_index = 0;
+        error_set_san(error, "FEN", 3);
+        parser_skip_game(parser);
+        return error->status;
+    }
+    if (visitor != NULL)
+    {
+        visit(visitor, board, 0, 0, 0);
+    }
+    while (parser_next_move(parser, &move, error))
+    {
+        if (board_try_complete_move(board, &move, error) != CHESS_OK)
+        {
+            // the move text is only copied once it is known to be bad
+            error->move_index = *move_count;
+            error_set_san(error, parser->token, parser->token_length);
+            parser_skip_game(parser);
+            return error->status;
+        }
+        uint64_t previous_hash = board_hash(board);
+        board_apply_move(board, &move);
+        (*move_count)++;
+        if (visitor != NULL)
+        {
+            visit(visitor, board, *move_count, move_pack(&move), previous_hash);
+        }
+        if (policy == OUTPUT_EVERY_MOVE)
+        {
+            board_render(board, out);
+        }
+    }
+
+    if (error->status != CHESS_OK)
+    {
+        error->move_index = *move_count;
+        parser_skip_game(parser);
+    }
+    else if (visitor != NULL && visitor->finish != NULL)
+    {
+        visitor->finish(visitor->context, parser_recorded_result(parser));
+    }
+    return error->status;
+}
+
+enum chess_status replay_archived_game(const struct archive *archive, size_t game, struct chess_board *board,
+                                       enum output_policy policy, struct output_buffer *out,
+                                       const struct replay_visitor *visitor, int *move_count,
+                                       struct chess_error *error)
+{
+    const struct archive_game *record = &archive->games[game];
+    const packed_move *moves = archive->moves + record->first_move;
+    struct chess_move move;
+
+    if (record->start == 0)
+    {
+        board_copy(board, &archive->start);
+    }
+    else
+    {
+        // archive_open has checked that every start can be set up
+        board_from_fen(board, archive->starts[record->start].fen);
+    }
+    if (visitor != NULL)
+    {
+        visit(visitor, board, 0, 0, 0);
+    }
+    for (*move_count = 0; *move_count < (int) record->move_count; (*move_count)++)
+    {
+        // the moves were checked when they were archived, so only a damaged file can get this wrong
+        if (!move_fits_board(board, moves[*move_count]))
+        {
+            error->status = CHESS_ERROR_NO_PIECE;
+            error->reason = "damaged archive";
+            error->move_index = *move_count;
+            error_set_san(error, "?", 1);
+            return error->status;
+        }
+        uint64_t previous_hash = board_hash(board);
+        move_unpack(board, moves[*move_count], &move);
+        board_apply_move(board, &move);
+        if (visitor != NULL)
+        {
+            visit(visitor, board, *move_count + 1, moves[*move_count], previous_hash);
+        }
+        if (policy == OUTPUT_EVERY_MOVE)
+        {
+            board_render(board, out);
+        }
+    }
+
+    // the text of a move that failed is not archived, only why it failed
+    error->status = (enum chess_status) record->status;
+    if (error->status != CHESS_OK)
+    {
+        error->reason = status_string(error->status);
+        error->move_index = *move_count;
+        error_set_san(error, "?", 1);
+    }
+    else if (visitor != NULL && visitor->finish != NULL)
+    {
+        visitor->finish(visitor->context, (enum recorded_result) record->result);
+    }
+    return error->status;
+}
+
+size_t replay_source_count(const struct replay_source *source)
+{
+    return source->archive != NULL ? source->archive->game_count : source->index->count;
+}
+
+enum chess_status replay_source_game(const struct replay_source *source, size_t game, struct chess_board *board,
+                                     enum output_policy policy, struct output_buffer *out,
+                                     const struct replay_visitor *visitor, int *move_count,
+                                     struct chess_error *error)
+{
+    if (source->archive != NULL)
+    {
+        return replay_archived_game(source->archive, game, board, policy, out, visitor, move_count, error);
+    }
+    size_t start = source->index->offsets[game];
+    struct parser parser;
+    parser_init(&parser, source->input->data + start, source->index->offsets[game + 1] - start,
+                source->index->format);
+    return replay_game(&parser, source->start, board, policy, out, visitor, move_count, error);
+}
+
+void replay_report(struct output_buffer *out, enum output_policy policy, enum chess_status status,
+                   const struct chess_board *board, const struct chess_error *error)
+{
+    if (policy == OUTPUT_FINAL)
+    {
+        board_render(board, out);
+    }
+    else if (policy == OUTPUT_FEN)
+    {
+        char fen[BOARD_FEN_MAX];
+        board_to_fen(board, fen, sizeof(fen));
+        output_append_line(out, fen);
+    }
+    if (status != CHESS_OK)
+    {
+        // moves are numbered from 1 for people reading the output
+        output_appendf(out, "error: move %d (%s): %s\n", error->move_index + 1, error->san, error->reason);
+    }
+    else
+    {
+        output_append_line(out, result_string(board_classify(board)));
+    }
+}
+
+// The ranges of a replay_pool_run call, and which of them are done.
+struct replay_pool
+{
+    size_t game_count;
+    size_t range_count;
+    replay_range_fn run;
+    void *context;
+    bool *done;
+
+    // guards next_range and done
+    pthread_mutex_t lock;
+    pthread_cond_t range_done;
+    size_t next_range;
+};
+
+struct replay_worker
+{
+    struct replay_pool *pool;
+    int index;
+    pthread_t thread;
+};
+
+size_t replay_pool_range_count(size_t game_count)
+{
+    return (game_count + GAMES_PER_RANGE - 1) / GAMES_PER_RANGE;
+}
+
+// Claims ranges in order until none are left.
+static void *replay_worker_run(void *arg)
+{
+    struct replay_worker *worker = arg;
+    struct replay_pool *pool = worker->pool;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        size_t next = pool->next_range++;
+        pthread_mutex_unlock(&pool->lock);
+        if (next >= pool->range_count)
+        {
+            return NULL;
+        }
+
+        size_t first = next * GAMES_PER_RANGE;
+        size_t end = next + 1 < pool->range_count ? first + GAMES_PER_RANGE : pool->game_count;
+        pool->run(pool->context, worker->index, next, first, end);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->done[next] = true;
+        pthread_cond_broadcast(&pool->range_done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void replay_pool_run(size_t game_count, int threads, replay_range_fn run, replay_range_done_fn done, void *context)
+{
+    struct replay_pool pool;
+    pool.game_count = game_count;
+    pool.range_count = replay_pool_range_count(game_count);
+    pool.run = run;
+    pool.context = context;
+    pool.next_range = 0;
+    pool.done = calloc(pool.range_count ? pool.range_count : 1, sizeof(bool));
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    struct replay_worker *workers = malloc((size_t) threads * sizeof(struct replay_worker));
+    if (pool.done == NULL || workers == NULL)
+    {
+        panicf("out of memory starting threads\n");
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.range_done, NULL);
+
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].pool = &pool;
+        workers[i].index = i;
+        if (pthread_create(&workers[i].thread, NULL, replay_worker_run, &workers[i]) != 0)
+        {
+            panicf("failed to start thread\n");
+        }
+    }
+
+    // hand each range on as soon as it and every range before it are finished, so that results can come out in
+    // input order while later ranges are still being worked on
+    for (size_t i = 0; done != NULL && i < pool.range_count; i++)
+    {
+        pthread_mutex_lock(&pool.lock);
+        while (!pool.done[i])
+        {
+            pthread_cond_wait(&pool.range_done, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+        done(context, i);
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+    free(workers);
+    pthread_cond_destroy(&pool.range_done);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.done);
+}
+
+// The output and results of replaying a range of games.
+struct replay_range
+{
+    struct output_buffer out;
+    long error_counts[CHESS_STATUS_COUNT];
+};
+
+struct replay_batch
+{
+    const struct replay_source *source;
+    enum output_policy policy;
+    struct replay_range *ranges;
+    long *error_counts;
+};
+
+static void replay_range(void *context, int thread, size_t index, size_t first, size_t end)
+{
+    const struct replay_batch *batch = context;
+    struct replay_range *range = &batch->ranges[index];
+    struct chess_board board;
+    struct chess_error error;
+    (void) thread;
+
+    for (size_t game = first; game < end; game++)
+    {
+        int move_count;
+        enum chess_status status = replay_source_game(batch->source, game, &board, batch->policy, &range->out, NULL,
+                                                      &move_count, &error);
+        replay_report(&range->out, batch->policy, status, &board, &error);
+        range->error_counts[status]++;
+    }
+}
+
+static void write_range(void *context, size_t index)
+{
+    struct replay_batch *batch = context;
+    struct replay_range *range = &batch->ranges[index];
+    output_flush(&range->out, stdout);
+    output_free(&range->out);
+    for (int status = 0; status < CHESS_STATUS_COUNT; status++)
+    {
+        batch->error_counts[status] += range->error_counts[status];
+    }
+}
+
+void replay_batch(const struct replay_source *source, int threads, enum output_policy policy,
+                  long error_counts[CHESS_STATUS_COUNT])
+{
+    size_t game_count = replay_source_count(source);
+    size_t range_count = replay_pool_range_count(game_count);
+    struct replay_batch batch;
+    batch.source = source;
+    batch.policy = policy;
+    batch.error_counts = error_counts;
+    batch.ranges = calloc(range_count ? range_count : 1, sizeof(struct replay_range));
+    if (batch.ranges == NULL)
+    {
+        panicf("out of memory splitting games\n");
+    }
+    for (size_t i = 0; i < range_count; i++)
+    {
+        output_init(&batch.ranges[i].out);
+    }
+    for (int status = 0; status < CHESS_STATUS_COUNT; status++)
+    {
+        error_counts[status] = 0;
+    }
+
+    replay_pool_run(game_count, threads, replay_range, write_range, &batch);
+    free(batch.ranges);
+}
+
+int replay_default_threads(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores > 0)
+    {
+        return (int) cores;
+    }
+#endif
+    return 1;
+}
@@ -0,0 +1,120 @@
+#ifndef APSC143__REPLAY_H
+#define APSC143__REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "archive.h"
+#include "board.h"
+#include "input.h"
+#include "output.h"
+#include "parser.h"
+#include "status.h"
+
+// How much of each game is drawn besides its result line. Drawing is the
+// slowest part of a replay, so large runs should stay quiet.
+enum output_policy
+{
+    OUTPUT_QUIET,      // the result line only
+    OUTPUT_FINAL,      // the final position, then the result line
+    OUTPUT_FEN,        // the final position as a FEN line, then the result line
+    OUTPUT_EVERY_MOVE, // the position after every move, then the result line
+};
+
+// One position of a replayed game: the start position at ply 0, then the
+// position after each move.
+struct replay_step
+{
+    const struct chess_board *board;
+    int ply;                // moves played so far
+    packed_move move;       // the move just played, 0 at ply 0
+    uint64_t previous_hash; // key of the position the move was played from, 0 at ply 0
+};
+
+// Something to be done at every position of a replayed game, e.g. recording
+// it in an index. visit is called with each step in order, on the thread
+// replaying the game. If finish is not NULL, it is then called with the
+// result the game records for itself, once all its moves have been replayed.
+struct replay_visitor
+{
+    void (*visit)(void *context, const struct replay_step *step);
+    void (*finish)(void *context, enum recorded_result result);
+    void *context;
+};
+
+// Replays the next game of the parser's input from the position in its FEN tag
+// if it has one, otherwise onto a copy of *start, or onto the initial position
+// if start is NULL. Returns CHESS_OK if every move could be replayed;
+// otherwise *error describes the first bad move, or CHESS_ERROR_START a FEN tag
+// that cannot be used, and the rest of the game has been skipped.
+// *move_count is set to the number of moves replayed. With OUTPUT_EVERY_MOVE
+// the board is drawn into *out after each move; otherwise out is not used and
+// can be NULL. If visitor is not NULL, it is shown every position replayed.
+enum chess_status replay_game(struct parser *parser, const struct chess_board *start, struct chess_board *board,
+                              enum output_policy policy, struct output_buffer *out,
+                              const struct replay_visitor *visitor, int *move_count, struct chess_error *error);
+
+// Same as replay_game, for the game with the given index in the archive. The
+// moves are already complete, so nothing is parsed or worked out. For a game
+// that failed when it was archived, *error gives the status but not the move
+// text.
+enum chess_status replay_archived_game(const struct archive *archive, size_t game, struct chess_board *board,
+                                       enum output_policy policy, struct output_buffer *out,
+                                       const struct replay_visitor *visitor, int *move_count,
+                                       struct chess_error *error);
+
+// Where a set of games comes from: the indexed games of an input, each
+// replayed from *start (or the initial position if start is NULL), or the
+// games of an archive if archive is not NULL.
+struct replay_source
+{
+    const struct input *input;
+    const struct game_index *index;
+    const struct chess_board *start;
+    const struct archive *archive;
+};
+
+// Gets the number of games in the source.
+size_t replay_source_count(const struct replay_source *source);
+
+// Replays the game with the given index in the source, with replay_game or
+// replay_archived_game.
+enum chess_status replay_source_game(const struct replay_source *source, size_t game, struct chess_board *board,
+                                     enum output_policy policy, struct output_buffer *out,
+                                     const struct replay_visitor *visitor, int *move_count,
+                                     struct chess_error *error);
+
+// Appends the result of a replayed game: the board summary, or the error if
+// the game could not be replayed. With OUTPUT_FINAL or OUTPUT_FEN the final
+// position is written first.
+void replay_report(struct output_buffer *out, enum output_policy policy, enum chess_status status,
+                   const struct chess_board *board, const struct chess_error *error);
+
+// Does work on the games [first, end) of a set, on the thread with the given
+// index, for replay_pool_run.
+typedef void (*replay_range_fn)(void *context, int thread, size_t range, size_t first, size_t end);
+
+// Called for a range of games once it is finished, for replay_pool_run.
+typedef void (*replay_range_done_fn)(void *context, size_t range);
+
+// Gets the number of ranges replay_pool_run splits that many games into.
+size_t replay_pool_range_count(size_t game_count);
+
+// Splits the games [0, game_count) into ranges and has the given number of
+// threads claim them in order and run each. Ranges are numbered from 0, and
+// threads from 0 to threads - 1, so that a thread can keep its own state. If
+// done is not NULL, it is called on the calling thread for each range in
+// order, as soon as that range and every one before it are finished. Returns
+// once every range is done.
+void replay_pool_run(size_t game_count, int threads, replay_range_fn run, replay_range_done_fn done, void *context);
+
+// Replays every game of the source on the given number of threads, each game
+// on its thread's own board, and writes the output of each game to standard
+// output in input order. error_counts[status] is set to the number of games
+// that ended with each status.
+void replay_batch(const struct replay_source *source, int threads, enum output_policy policy,
+                  long error_counts[CHESS_STATUS_COUNT]);
+
+// Number of threads to use when asked for one per core.
+int replay_default_threads(void);
+
+#endif
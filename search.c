@@ -0,0 +1,394 @@
+#include "search.h"
+#include <stdlib.h>
+#include <string.h>
+#include "bitboard.h"
+#include "movegen.h"
+#include "timer.h"
+
+#define SCORE_INFINITY (SEARCH_MATE + 1)
+
+// How often, in nodes, the clock is read.
+#define CLOCK_CHECK_INTERVAL 1024
+
+// Move ordering keys, highest first. History scores stay below KILLER_SCORE.
+#define BEST_MOVE_SCORE (1 << 30)
+#define CAPTURE_SCORE (1 << 24)
+#define KILLER_SCORE (1 << 20)
+#define HISTORY_LIMIT (1 << 19)
+
+// Material in centipawns, by piece type.
+static const int piece_values[6] = {100, 320, 330, 500, 900, 0};
+
+// Bonuses by square for each piece type, from white's side of the board with
+// the eighth rank first, so that white's square s is entry s ^ 56 and black's
+// is entry s. These are the usual "simplified evaluation" tables.
+static const int piece_square_tables[6][64] = {
+    { // pawn
+         0,   0,   0,   0,   0,   0,   0,   0,
+        50,  50,  50,  50,  50,  50,  50,  50,
+        10,  10,  20,  30,  30,  20,  10,  10,
+         5,   5,  10,  25,  25,  10,   5,   5,
+         0,   0,   0,  20,  20,   0,   0,   0,
+         5,  -5, -10,   0,   0, -10,  -5,   5,
+         5,  10,  10, -20, -20,  10,  10,   5,
+         0,   0,   0,   0,   0,   0,   0,   0,
+    },
+    { // knight
+       -50, -40, -30, -30, -30, -30, -40, -50,
+       -40, -20,   0,   0,   0,   0, -20, -40,
+       -30,   0,  10,  15,  15,  10,   0, -30,
+       -30,   5,  15,  20,  20,  15,   5, -30,
+       -30,   0,  15,  20,  20,  15,   0, -30,
+       -30,   5,  10,  15,  15,  10,   5, -30,
+       -40, -20,   0,   5,   5,   0, -20, -40,
+       -50, -40, -30, -30, -30, -30, -40, -50,
+    },
+    { // bishop
+       -20, -10, -10, -10, -10, -10, -10, -20,
+       -10,   0,   0,   0,   0,   0,   0, -10,
+       -10,   0,   5,  10,  10,   5,   0, -10,
+       -10,   5,   5,  10,  10,   5,   5, -10,
+       -10,   0,  10,  10,  10,  10,   0, -10,
+       -10,  10,  10,  10,  10,  10,  10, -10,
+       -10,   5,   0,   0,   0,   0,   5, -10,
+       -20, -10, -10, -10, -10, -10, -10, -20,
+    },
+    { // rook
+         0,   0,   0,   0,   0,   0,   0,   0,
+         5,  10,  10,  10,  10,  10,  10,   5,
+        -5,   0,   0,   0,   0,   0,   0,  -5,
+        -5,   0,   0,   0,   0,   0,   0,  -5,
+        -5,   0,   0,   0,   0,   0,   0,  -5,
+        -5,   0,   0,   0,   0,   0,   0,  -5,
+        -5,   0,   0,   0,   0,   0,   0,  -5,
+         0,   0,   0,   5,   5,   0,   0,   0,
+    },
+    { // queen
+       -20, -10, -10,  -5,  -5, -10, -10, -20,
+       -10,   0,   0,   0,   0,   0,   0, -10,
+       -10,   0,   5,   5,   5,   5,   0, -10,
+        -5,   0,   5,   5,   5,   5,   0,  -5,
+         0,   0,   5,   5,   5,   5,   0,  -5,
+       -10,   5,   5,   5,   5,   5,   0, -10,
+       -10,   0,   5,   0,   0,   0,   0, -10,
+       -20, -10, -10,  -5,  -5, -10, -10, -20,
+    },
+    { // king, kept behind its pawns for the middlegame
+       -30, -40, -40, -50, -50, -40, -40, -30,
+       -30, -40, -40, -50, -50, -40, -40, -30,
+       -30, -40, -40, -50, -50, -40, -40, -30,
+       -30, -40, -40, -50, -50, -40, -40, -30,
+       -20, -30, -30, -40, -40, -30, -30, -20,
+       -10, -20, -20, -20, -20, -20, -20, -10,
+        20,  20,   0,   0,   0,   0,  20,  20,
+        20,  30,  10,   0,   0,  10,  30,  20,
+    },
+};
+
+struct search
+{
+    struct chess_board board;
+    const struct search_limits *limits;
+    double deadline; // in seconds on the same clock as timer_seconds, 0 for none
+    long long nodes;
+    bool can_stop;   // set once depth 1 is finished, so that there is always a move
+    bool stopped;
+
+    packed_move root_best;  // best move of the last finished iteration, tried first
+    packed_move root_move;  // best move so far in the current iteration
+
+    // Quiet moves that caused a cutoff at each ply, most recent first.
+    packed_move killers[SEARCH_MAX_DEPTH][2];
+
+    // How often each quiet move caused a cutoff, weighted by depth, by
+    // [player][from][to].
+    int history[2][64][64];
+};
+
+// Scores the position for the player to move from material and piece squares.
+static int evaluate(const struct chess_board *board)
+{
+    int score = 0;
+    for (int type = PIECE_PAWN; type <= PIECE_KING; type++) {
+        bitboard white = board_pieces(board, PLAYER_WHITE, (enum piece_type) type);
+        bitboard black = board_pieces(board, PLAYER_BLACK, (enum piece_type) type);
+        score += piece_values[type] * (bitboard_count(white) - bitboard_count(black));
+        while (white) {
+            score += piece_square_tables[type][bitboard_pop_lsb(&white) ^ 56];
+        }
+        while (black) {
+            score -= piece_square_tables[type][bitboard_pop_lsb(&black)];
+        }
+    }
+    return board->next_move_player == PLAYER_WHITE ? score : -score;
+}
+
+// Checks for the draws that hold whatever moves there are. The fifty-move rule
+// is left to the callers, since checkmate on the hundredth half-move still wins.
+static bool is_draw(const struct chess_board *board)
+{
+    // one repetition is enough: whatever was best the first time is best again
+    return board_repetitions(board) > 0 || board_insufficient_material(board);
+}
+
+// Counts a node and checks the limits. Returns true if the search must stop.
+static bool count_node(struct search *search)
+{
+    search->nodes++;
+    if (!search->can_stop) {
+        return false;
+    }
+    if (search->limits->nodes > 0 && search->nodes >= search->limits->nodes) {
+        search->stopped = true;
+    } else if (search->deadline > 0 && search->nodes % CLOCK_CHECK_INTERVAL == 0 &&
+               timer_seconds() >= search->deadline) {
+        search->stopped = true;
+    }
+    return search->stopped;
+}
+
+static bool is_quiet(packed_move move)
+{
+    return (PACKED_FLAGS(move) & (MOVE_CAPTURE | MOVE_PROMOTION)) == 0;
+}
+
+// Gives each move an ordering key, and drops the quiet moves if only captures
+// and promotions are wanted. Returns the number of moves kept.
+static int order_moves(const struct search *search, struct chess_move_list *list, int *keys, int ply, bool noisy_only)
+{
+    const struct chess_board *board = &search->board;
+    int kept = 0;
+    for (int i = 0; i < list->count; i++) {
+        packed_move move = list->moves[i];
+        int from = PACKED_FROM(move);
+        int to = PACKED_TO(move);
+        int flags = PACKED_FLAGS(move);
+        int key;
+
+        if (ply == 0 && move == search->root_best) {
+            key = BEST_MOVE_SCORE;
+        } else if (!is_quiet(move)) {
+            // most valuable victim first, then least valuable attacker
+            int victim_value = 0;
+            if (flags == MOVE_EN_PASSANT) {
+                victim_value = piece_values[PIECE_PAWN];
+            } else if (flags & MOVE_CAPTURE) {
+                victim_value = piece_values[PIECE_CODE_TYPE(board_piece_at(board, to))];
+            }
+            key = CAPTURE_SCORE + victim_value * 8 - PIECE_CODE_TYPE(board_piece_at(board, from));
+            if (flags & MOVE_PROMOTION) {
+                key += piece_values[PIECE_KNIGHT + (flags & 3)];
+            }
+        } else if (noisy_only) {
+            continue;
+        } else if (ply < SEARCH_MAX_DEPTH && move == search->killers[ply][0]) {
+            key = KILLER_SCORE + 1;
+        } else if (ply < SEARCH_MAX_DEPTH && move == search->killers[ply][1]) {
+            key = KILLER_SCORE;
+        } else {
+            key = search->history[board->next_move_player][from][to];
+        }
+        list->moves[kept] = move;
+        keys[kept++] = key;
+    }
+    list->count = kept;
+    return kept;
+}
+
+// Moves the best of the moves from index on to index, so that the list is
+// only sorted as far as it is searched.
+static packed_move pick_move(struct chess_move_list *list, int *keys, int index)
+{
+    int best = index;
+    for (int i = index + 1; i < list->count; i++) {
+        if (keys[i] > keys[best]) {
+            best = i;
+        }
+    }
+    packed_move move = list->moves[best];
+    int key = keys[best];
+    list->moves[best] = list->moves[index];
+    keys[best] = keys[index];
+    list->moves[index] = move;
+    keys[index] = key;
+    return move;
+}
+
+// Remembers a quiet move that caused a cutoff.
+static void record_cutoff(struct search *search, packed_move move, int depth, int ply)
+{
+    if (ply < SEARCH_MAX_DEPTH && search->killers[ply][0] != move) {
+        search->killers[ply][1] = search->killers[ply][0];
+        search->killers[ply][0] = move;
+    }
+
+    int (*history)[64] = search->history[search->board.next_move_player];
+    int *entry = &history[PACKED_FROM(move)][PACKED_TO(move)];
+    *entry += depth * depth;
+    if (*entry >= HISTORY_LIMIT) {
+        // halving everything keeps the order while making room, and lets old cutoffs fade
+        for (int from = 0; from < 64; from++) {
+            for (int to = 0; to < 64; to++) {
+                history[from][to] /= 2;
+            }
+        }
+    }
+}
+
+// Searches captures and promotions only, until the position is quiet enough
+// for the static evaluation to be trusted. In check, every evasion is tried.
+static int quiesce(struct search *search, int ply, int alpha, int beta)
+{
+    struct chess_board *board = &search->board;
+    if (count_node(search)) {
+        return 0;
+    }
+    if (is_draw(board)) {
+        return 0;
+    }
+
+    struct chess_move_list list;
+    int keys[MAX_LEGAL_MOVES];
+    bool check = is_in_check(board, board->next_move_player);
+    if (board_generate_moves(board, &list) == 0) {
+        return check ? -(SEARCH_MATE - ply) : 0;
+    }
+    if (board->halfmove_clock >= 100) {
+        return 0;
+    }
+
+    int best = -SCORE_INFINITY;
+    if (!check) {
+        // standing pat: the player to move need not capture anything
+        best = evaluate(board);
+        if (best >= beta) {
+            return best;
+        }
+        if (best > alpha) {
+            alpha = best;
+        }
+    }
+
+    order_moves(search, &list, keys, ply, !check);
+    struct chess_move move;
+    struct board_undo undo;
+    for (int i = 0; i < list.count; i++) {
+        move_unpack(board, pick_move(&list, keys, i), &move);
+        board_make_move(board, &move, &undo);
+        int score = -quiesce(search, ply + 1, -beta, -alpha);
+        board_unmake_move(board, &move, &undo);
+        if (search->stopped) {
+            return 0;
+        }
+
+        if (score > best) {
+            best = score;
+            if (score > alpha) {
+                alpha = score;
+                if (alpha >= beta) {
+                    break;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+static int alpha_beta(struct search *search, int depth, int ply, int alpha, int beta)
+{
+    struct chess_board *board = &search->board;
+    if (ply > 0 && is_draw(board)) {
+        return 0;
+    }
+    if (depth == 0) {
+        return quiesce(search, ply, alpha, beta);
+    }
+    if (count_node(search)) {
+        return 0;
+    }
+
+    struct chess_move_list list;
+    int keys[MAX_LEGAL_MOVES];
+    if (board_generate_moves(board, &list) == 0) {
+        return is_in_check(board, board->next_move_player) ? -(SEARCH_MATE - ply) : 0;
+    }
+    if (ply > 0 && board->halfmove_clock >= 100) {
+        return 0;
+    }
+    order_moves(search, &list, keys, ply, false);
+
+    int best = -SCORE_INFINITY;
+    struct chess_move move;
+    struct board_undo undo;
+    for (int i = 0; i < list.count; i++) {
+        packed_move packed = pick_move(&list, keys, i);
+        move_unpack(board, packed, &move);
+        board_make_move(board, &move, &undo);
+        int score = -alpha_beta(search, depth - 1, ply + 1, -beta, -alpha);
+        board_unmake_move(board, &move, &undo);
+        if (search->stopped) {
+            return 0;
+        }
+
+        if (score > best) {
+            best = score;
+            if (ply == 0) {
+                search->root_move = packed;
+            }
+            if (score > alpha) {
+                alpha = score;
+                if (alpha >= beta) {
+                    if (is_quiet(packed)) {
+                        record_cutoff(search, packed, depth, ply);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+bool board_search(const struct chess_board *board, const struct search_limits *limits,
+                  struct search_result *result)
+{
+    struct search search;
+    memset(&search, 0, sizeof(search));
+    board_copy(&search.board, board);
+    search.limits = limits;
+    double start = timer_seconds();
+    search.deadline = limits->milliseconds > 0 ? start + (double) limits->milliseconds / 1000 : 0;
+
+    result->best_move = 0;
+    result->depth = 0;
+    result->nodes = 0;
+    struct chess_move_list list;
+    if (board_generate_moves(board, &list) == 0) {
+        result->score = is_in_check(board, board->next_move_player) ? -SEARCH_MATE : 0;
+        return false;
+    }
+
+    int max_depth = limits->depth > 0 && limits->depth < SEARCH_MAX_DEPTH ? limits->depth : SEARCH_MAX_DEPTH;
+    for (int depth = 1; depth <= max_depth; depth++) {
+        int score = alpha_beta(&search, depth, 0, -SCORE_INFINITY, SCORE_INFINITY);
+        if (search.stopped) {
+            break;
+        }
+        result->best_move = search.root_move;
+        result->score = score;
+        result->depth = depth;
+        search.root_best = search.root_move;
+        search.can_stop = true;
+
+        // a mate within the full-width depth cannot be bettered by searching deeper, and an iteration that took
+        // more than half the time would not finish the next one
+        if (SEARCH_IS_MATE(score) && SEARCH_MATE - abs(score) <= depth) {
+            break;
+        }
+        if (search.deadline > 0 && timer_seconds() - start > (search.deadline - start) / 2) {
+            break;
+        }
+    }
+    result->nodes = search.nodes;
+    return true;
+}
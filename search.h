@@ -0,0 +1,43 @@
+#ifndef APSC143__SEARCH_H
+#define APSC143__SEARCH_H
+
+#include <stdbool.h>
+#include "board.h"
+
+// Deepest search board_search will start, in plies.
+#define SEARCH_MAX_DEPTH 64
+
+// Scores are in centipawns from the point of view of the player to move. A
+// mate is scored SEARCH_MATE less the number of plies to it, so that a
+// quicker mate scores higher; being mated scores the negative.
+#define SEARCH_MATE 30000
+#define SEARCH_IS_MATE(score) ((score) > SEARCH_MATE - 1000 || (score) < -(SEARCH_MATE - 1000))
+
+// When to stop searching. A zero field sets no limit, but at least one should
+// be set. The search always finishes depth 1, so it always has a move.
+struct search_limits
+{
+    int depth;          // deepest iteration to finish, in plies
+    long long nodes;    // positions to visit, counting quiescence
+    long milliseconds;  // time to spend
+};
+
+struct search_result
+{
+    packed_move best_move; // 0 if the player to move has no legal move
+    int score;
+    int depth;             // deepest iteration finished
+    long long nodes;
+};
+
+// Searches the position with alpha-beta negamax and iterative deepening,
+// ending each line in a quiescence search of captures and promotions. Moves
+// are tried best first: the best move of the previous iteration, then captures
+// by most valuable victim and least valuable attacker, then killer moves, then
+// by history. Repetitions, the fifty-move rule and insufficient material score
+// as draws. Returns false if the player to move has no legal move, with the
+// score set for checkmate or stalemate. Does not allocate.
+bool board_search(const struct chess_board *board, const struct search_limits *limits,
+                  struct search_result *result);
+
+#endif
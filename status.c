@@ -0,0 +1,28 @@
+#include "status.h"
+#include <string.h>
+
+const char *status_string(enum chess_status status) {
+    switch (status) {
+        case CHESS_OK:
+            return "ok";
+        case CHESS_ERROR_SYNTAX:
+            return "syntax error";
+        case CHESS_ERROR_NO_PIECE:
+            return "no piece can move";
+        case CHESS_ERROR_AMBIGUOUS:
+            return "ambiguous move";
+        case CHESS_ERROR_ILLEGAL:
+            return "illegal move";
+        case CHESS_ERROR_START:
+            return "bad start position";
+    }
+    return "unknown";
+}
+
+void error_set_san(struct chess_error *error, const char *san, size_t length) {
+    if (length > sizeof(error->san) - 1) {
+        length = sizeof(error->san) - 1;
+    }
+    memcpy(error->san, san, length);
+    error->san[length] = '\0';
+}
@@ -0,0 +1,38 @@
+#ifndef APSC143__STATUS_H
+#define APSC143__STATUS_H
+
+#include <stddef.h>
+
+// Result of parsing or completing a move, or of setting up the position a game
+// starts from. Anything other than CHESS_OK means the move, and therefore the
+// rest of its game, cannot be replayed.
+enum chess_status
+{
+    CHESS_OK,
+    CHESS_ERROR_SYNTAX,    // the token is not valid move notation
+    CHESS_ERROR_NO_PIECE,  // no piece of the player to move can make the move
+    CHESS_ERROR_AMBIGUOUS, // several pieces can make the move
+    CHESS_ERROR_ILLEGAL,   // the move breaks the rules, e.g. a blocked castle
+    CHESS_ERROR_START      // the game cannot start where it says, e.g. a bad FEN tag
+};
+
+#define CHESS_STATUS_COUNT 6
+
+// Details of a failed move. Filling one in never allocates or formats text:
+// reason always points to a string literal.
+struct chess_error
+{
+    enum chess_status status;
+    int move_index;     // 0-based index of the move within its game
+    char san[16];       // the move as written, truncated and NUL-terminated
+    const char *reason;
+};
+
+// Copies the move text into error->san, truncating it if needed. The text does
+// not need to be NUL-terminated.
+void error_set_san(struct chess_error *error, const char *san, size_t length);
+
+// Gets a short lowercase description of the status.
+const char *status_string(enum chess_status status);
+
+#endif
@@ -0,0 +1,15 @@
+#define _POSIX_C_SOURCE 200112L
+#include "timer.h"
+#include <time.h>
+
+double timer_seconds(void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    // a monotonic clock does not jump when the system time is set, so a deadline measured on it holds
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,10 @@
+#ifndef APSC143__TIMER_H
+#define APSC143__TIMER_H
+
+// Gets a time in seconds, for measuring how long something took or setting a
+// deadline. Only differences between two calls mean anything; the clock is
+// monotonic where the system has one, so setting the system time does not
+// move it.
+double timer_seconds(void);
+
+#endif
@@ -0,0 +1,43 @@
+#include "zobrist.h"
+
+uint64_t zobrist_pieces[2][6][64];
+uint64_t zobrist_castling[16];
+uint64_t zobrist_en_passant[8];
+uint64_t zobrist_black_to_move;
+
+// SplitMix64, a small generator with good enough output for hash keys.
+static uint64_t next_key(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void zobrist_init(void)
+{
+    uint64_t state = 0x43484553535A4F42ULL;
+
+    for (int colour = 0; colour < 2; colour++)
+    {
+        for (int piece = 0; piece < 6; piece++)
+        {
+            for (int square = 0; square < 64; square++)
+            {
+                zobrist_pieces[colour][piece][square] = next_key(&state);
+            }
+        }
+    }
+
+    // no rights at all is the usual case late in a game, so it keeps a zero key
+    zobrist_castling[0] = 0;
+    for (int rights = 1; rights < 16; rights++)
+    {
+        zobrist_castling[rights] = next_key(&state);
+    }
+    for (int file = 0; file < 8; file++)
+    {
+        zobrist_en_passant[file] = next_key(&state);
+    }
+    zobrist_black_to_move = next_key(&state);
+}
@@ -0,0 +1,20 @@
+#ifndef APSC143__ZOBRIST_H
+#define APSC143__ZOBRIST_H
+
+#include <stdint.h>
+
+// Random keys for Zobrist hashing. A position's key is the XOR of the keys of
+// everything in it: each piece on its square, the castling rights, the en
+// passant file if a pawn can be taken en passant, and the side to move if it
+// is black. Changing one of these changes the key by a single XOR, which is
+// how board_apply_move keeps it up to date.
+extern uint64_t zobrist_pieces[2][6][64]; // [colour][piece type][square]
+extern uint64_t zobrist_castling[16];     // [castling rights]
+extern uint64_t zobrist_en_passant[8];    // [file]
+extern uint64_t zobrist_black_to_move;
+
+// Fills in the keys. They come from a fixed seed, so keys are the same on
+// every run and can be stored in files.
+void zobrist_init(void);
+
+#endif